@@ -3,6 +3,10 @@
 #include <string.h>
 #include <math.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #include "attacks.h"
 #include "bitboard.h"
 #include "position.h"
@@ -70,8 +74,7 @@ u64 negative_ray_attacks(u64 occupancy, enum Direction dir, enum Square sq) {
     return attacks;
 }
 
-u64 attacks_from(enum Piece_type pt, const struct Position *pos, enum Square sq) {
-    u64 occupancy = pos_occupancy(pos);
+u64 slider_attacks(enum Piece_type pt, u64 occupancy, enum Square sq) {
     switch (pt) {
         case ROOK:
             return positive_ray_attacks(occupancy, NORTH, sq) |
@@ -85,8 +88,20 @@ u64 attacks_from(enum Piece_type pt, const struct Position *pos, enum Square sq)
                 negative_ray_attacks(occupancy, SOUTHWEST, sq);
 
         case QUEEN:
-            return attacks_from(BISHOP, pos, sq) |
-                   attacks_from(ROOK, pos, sq);
+            return slider_attacks(BISHOP, occupancy, sq) |
+                   slider_attacks(ROOK, occupancy, sq);
+
+        default:
+            return 0ULL;
+    }
+}
+
+u64 attacks_from(enum Piece_type pt, const struct Position *pos, enum Square sq) {
+    switch (pt) {
+        case ROOK:
+        case BISHOP:
+        case QUEEN:
+            return slider_attacks(pt, pos_occupancy(pos), sq);
 
         case KING:
             return king_attacks(sq);
@@ -99,3 +114,107 @@ u64 attacks_from(enum Piece_type pt, const struct Position *pos, enum Square sq)
     }
 }
 
+//Kogge-Stone fill from gen through the empty squares in pro, in log2(7) steps, then one more shift onto
+//the first blocker. The wrap mask removes squares that wrapped around from the a or h file.
+static inline u64 occluded_fill_left(u64 gen, u64 pro, int shift, u64 wrap_mask) {
+    pro &= wrap_mask;
+    gen |= pro & (gen << shift);
+    pro &= pro << shift;
+    gen |= pro & (gen << 2 * shift);
+    pro &= pro << 2 * shift;
+    gen |= pro & (gen << 4 * shift);
+    return (gen << shift) & wrap_mask;
+}
+
+static inline u64 occluded_fill_right(u64 gen, u64 pro, int shift, u64 wrap_mask) {
+    pro &= wrap_mask;
+    gen |= pro & (gen >> shift);
+    pro &= pro >> shift;
+    gen |= pro & (gen >> 2 * shift);
+    pro &= pro >> 2 * shift;
+    gen |= pro & (gen >> 4 * shift);
+    return (gen >> shift) & wrap_mask;
+}
+
+u64 sliding_attacks_dir(u64 sliders, u64 empty, enum Direction dir) {
+    switch (dir) {
+        case NORTH:
+            return occluded_fill_left(sliders, empty, 8, ~0ULL);
+        case NORTHEAST:
+            return occluded_fill_left(sliders, empty, 9, ~FileABB);
+        case EAST:
+            return occluded_fill_left(sliders, empty, 1, ~FileABB);
+        case SOUTHEAST:
+            return occluded_fill_right(sliders, empty, 7, ~FileABB);
+        case SOUTH:
+            return occluded_fill_right(sliders, empty, 8, ~0ULL);
+        case SOUTHWEST:
+            return occluded_fill_right(sliders, empty, 9, ~FileHBB);
+        case WEST:
+            return occluded_fill_right(sliders, empty, 1, ~FileHBB);
+        case NORTHWEST:
+            return occluded_fill_left(sliders, empty, 7, ~FileHBB);
+        default:
+            return 0ULL;
+    }
+}
+
+#if defined(__AVX2__)
+/*
+    Four directions at once, one per 64-bit lane. AVX2 only has per-lane variable shifts in a fixed
+    direction, so every shift is a left shift followed by a right shift, with a count of 0 for the
+    direction a lane doesn't use.
+*/
+static inline __m256i shift_lanes(__m256i bb, __m256i left, __m256i right) {
+    return _mm256_srlv_epi64(_mm256_sllv_epi64(bb, left), right);
+}
+
+static u64 occluded_fill_4(u64 sliders, u64 empty, __m256i left, __m256i right, __m256i wrap_mask) {
+    __m256i gen = _mm256_set1_epi64x((long long) sliders);
+    __m256i pro = _mm256_and_si256(_mm256_set1_epi64x((long long) empty), wrap_mask);
+    __m256i left2 = _mm256_add_epi64(left, left), right2 = _mm256_add_epi64(right, right);
+    __m256i left4 = _mm256_add_epi64(left2, left2), right4 = _mm256_add_epi64(right2, right2);
+
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift_lanes(gen, left, right)));
+    pro = _mm256_and_si256(pro, shift_lanes(pro, left, right));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift_lanes(gen, left2, right2)));
+    pro = _mm256_and_si256(pro, shift_lanes(pro, left2, right2));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift_lanes(gen, left4, right4)));
+    __m256i attacks = _mm256_and_si256(shift_lanes(gen, left, right), wrap_mask);
+
+    //OR the four lanes together.
+    __m128i half = _mm_or_si128(_mm256_castsi256_si128(attacks), _mm256_extracti128_si256(attacks, 1));
+    return (u64) (_mm_cvtsi128_si64(half) | _mm_extract_epi64(half, 1));
+}
+
+//Lanes: north, east, south, west.
+u64 rook_attacks_setwise(u64 rooks, u64 empty) {
+    const __m256i left = _mm256_setr_epi64x(8, 1, 0, 0);
+    const __m256i right = _mm256_setr_epi64x(0, 0, 8, 1);
+    const __m256i wrap_mask = _mm256_setr_epi64x(-1LL, (long long) ~FileABB, -1LL, (long long) ~FileHBB);
+    return occluded_fill_4(rooks, empty, left, right, wrap_mask);
+}
+
+//Lanes: northeast, northwest, southeast, southwest.
+u64 bishop_attacks_setwise(u64 bishops, u64 empty) {
+    const __m256i left = _mm256_setr_epi64x(9, 7, 0, 0);
+    const __m256i right = _mm256_setr_epi64x(0, 0, 7, 9);
+    const __m256i wrap_mask = _mm256_setr_epi64x((long long) ~FileABB, (long long) ~FileHBB,
+                                                  (long long) ~FileABB, (long long) ~FileHBB);
+    return occluded_fill_4(bishops, empty, left, right, wrap_mask);
+}
+#else
+u64 rook_attacks_setwise(u64 rooks, u64 empty) {
+    return sliding_attacks_dir(rooks, empty, NORTH) | sliding_attacks_dir(rooks, empty, EAST)
+         | sliding_attacks_dir(rooks, empty, SOUTH) | sliding_attacks_dir(rooks, empty, WEST);
+}
+
+u64 bishop_attacks_setwise(u64 bishops, u64 empty) {
+    return sliding_attacks_dir(bishops, empty, NORTHEAST) | sliding_attacks_dir(bishops, empty, NORTHWEST)
+         | sliding_attacks_dir(bishops, empty, SOUTHEAST) | sliding_attacks_dir(bishops, empty, SOUTHWEST);
+}
+#endif
+
+u64 queen_attacks_setwise(u64 queens, u64 empty) {
+    return rook_attacks_setwise(queens, empty) | bishop_attacks_setwise(queens, empty);
+}
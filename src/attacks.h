@@ -9,6 +9,20 @@ u64 king_attacks(enum Square sq);
 u64 positive_ray_attacks(u64 occupancy, enum Direction dir, enum Square sq);
 u64 negative_ray_attacks(u64 occupancy, enum Direction dir, enum Square sq);
 
+//Attacks of a rook, bishop or queen on sq with the given occupancy.
+u64 slider_attacks(enum Piece_type pt, u64 occupancy, enum Square sq);
+
+/*
+    Set-wise slider attacks by Kogge-Stone occluded fill: the combined attacks of every slider in the
+    sliders bitboard, given the empty squares. Meant for evaluation terms that need the attacks of all
+    pieces of a type at once, where looping over attacks_from would cost one lookup per piece.
+    When built with AVX2, the four directions of a rook or bishop are filled in parallel.
+*/
+u64 sliding_attacks_dir(u64 sliders, u64 empty, enum Direction dir);
+u64 rook_attacks_setwise(u64 rooks, u64 empty);
+u64 bishop_attacks_setwise(u64 bishops, u64 empty);
+u64 queen_attacks_setwise(u64 queens, u64 empty);
+
 struct Position;
 u64 attacks_from(enum Piece_type pt, const struct Position *pos, enum Square sq);
 u64 attackers_to(enum Square sq, const struct Position *pos, enum Side us);
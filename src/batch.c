@@ -0,0 +1,312 @@
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "fen.h"
+#include "position.h"
+
+#define RESULT_SZ 2048
+//Positions in flight per thread. This bounds the memory use for any input size.
+#define WINDOW_PER_THREAD 64
+
+/*
+    The input file is mapped into memory and tasks point directly into the mapping.
+    The reader thread hands out positions round-robin to per-thread queues. A thread takes
+    the oldest position of its own queue and steals from the others when its own is empty,
+    so expensive positions don't leave other threads idle. Results are written in input order
+    as soon as all earlier positions are done. Reading blocks while the window of positions
+    in flight is full.
+*/
+
+struct Batch_task {
+    const char *line;
+    size_t len;
+    char result[RESULT_SZ];
+    bool done;
+};
+
+//Queue of task sequence numbers, holding the entries in [head, tail).
+struct Task_queue {
+    pthread_mutex_t lock;
+    u64 *items;
+    u64 head;
+    u64 tail;
+};
+
+struct Batch_pool {
+    struct Search_limits limits;
+    int num_threads;
+    u64 window;
+    struct Batch_task *tasks; //Indexed by sequence number modulo the window
+    struct Task_queue *queues;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t space_available;
+    u64 queued; //Tasks in the queues not claimed by any thread yet
+    u64 next_seq;
+    u64 next_output;
+    bool input_done;
+
+    FILE *out;
+    u64 total_nodes;
+};
+
+struct Batch_worker {
+    struct Batch_pool *pool;
+    int id;
+};
+
+static void queue_push(struct Batch_pool *pool, struct Task_queue *q, u64 seq) {
+    pthread_mutex_lock(&q->lock);
+    q->items[q->tail++ % pool->window] = seq;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static bool queue_pop(struct Batch_pool *pool, struct Task_queue *q, u64 *seq) {
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *seq = q->items[q->head++ % pool->window];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+//Takes a task from the own queue, or steals one. The caller has claimed one of the queued tasks,
+//so there is always one to find.
+static u64 take_task(struct Batch_pool *pool, int id) {
+    u64 seq;
+    for (;;) {
+        for (int i = 0; i < pool->num_threads; ++i) {
+            if (queue_pop(pool, &pool->queues[(id + i) % pool->num_threads], &seq))
+                return seq;
+        }
+    }
+}
+
+//Length of the first four fields of an EPD or FEN line, which fen_parse has accepted.
+static int epd_fields_len(const char *line, const char *end) {
+    const char *p = line;
+    for (int field = 0; field < 4; ++field) {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        while (p < end && *p != ' ' && *p != '\t')
+            ++p;
+    }
+    return (int) (p - line);
+}
+
+//Copies the id operation (id "...";) of an EPD line to buff, if there is one.
+static int copy_id(const char *operations, const char *end, char *buff, size_t size) {
+    for (const char *id = operations; id + 4 < end; ++id) {
+        if (memcmp(id, "id \"", 4) != 0)
+            continue;
+        const char *quote = memchr(id + 4, '"', end - id - 4);
+        if (quote == NULL)
+            return 0;
+        return snprintf(buff, size, " id %.*s;", (int) (quote - id - 2), id + 3);
+    }
+    return 0;
+}
+
+//snprintf returns the untruncated length. Keeps the write position inside the result buffer,
+//with room left for the final newline.
+static int clamp_result_idx(int idx) {
+    return idx < RESULT_SZ - 2 ? idx : RESULT_SZ - 2;
+}
+
+static void analyze(struct Batch_task *task, struct Search_info *si, struct Search_limits limits) {
+    struct Position pos;
+    const char *line_end = task->line + task->len;
+    const char *operations;
+    enum Fen_error err = fen_parse(task->line, line_end, &pos, &operations);
+    if (err != FEN_OK) {
+        snprintf(task->result, RESULT_SZ, "%.*s ; error \"%s\";\n", (int) task->len, task->line, fen_error_str(err));
+        si->nodes = 0;
+        return;
+    }
+
+    struct Move best_move;
+    search_info_init(si, limits);
+    si->silent = true;
+    int score = search(&pos, si, &best_move);
+
+    char move_str[6];
+    int idx = clamp_result_idx(snprintf(task->result, RESULT_SZ, "%.*s", epd_fields_len(task->line, line_end),
+                                        task->line));
+    if (si->root_pv_length > 0) {
+        move_to_str(best_move, move_str);
+        idx = clamp_result_idx(idx + snprintf(&task->result[idx], RESULT_SZ - idx,
+                                              " bm %s; ce %d; acd %d; acn %llu; pv", move_str, score,
+                                              si->completed_depth, (unsigned long long) si->nodes));
+        for (int i = 0; i < si->root_pv_length && idx < RESULT_SZ - 16; ++i) {
+            move_to_str(si->root_pv[i], move_str);
+            idx = clamp_result_idx(idx + snprintf(&task->result[idx], RESULT_SZ - idx, " %s", move_str));
+        }
+        idx = clamp_result_idx(idx + snprintf(&task->result[idx], RESULT_SZ - idx, ";"));
+    } else {
+        //Checkmate or stalemate
+        idx = clamp_result_idx(idx + snprintf(&task->result[idx], RESULT_SZ - idx, " ce %d; acd 0; acn %llu;", score,
+                                              (unsigned long long) si->nodes));
+    }
+    idx = clamp_result_idx(idx + copy_id(operations, line_end, &task->result[idx], RESULT_SZ - idx - 1));
+    snprintf(&task->result[idx], RESULT_SZ - idx, "\n");
+    search_info_destroy(si);
+}
+
+//Writes all finished results that have no unfinished position before them. Called with the pool lock held.
+static void flush_results(struct Batch_pool *pool) {
+    while (pool->next_output < pool->next_seq) {
+        struct Batch_task *task = &pool->tasks[pool->next_output % pool->window];
+        if (!task->done)
+            break;
+        fputs(task->result, pool->out);
+        task->done = false;
+        ++pool->next_output;
+        pthread_cond_signal(&pool->space_available);
+    }
+}
+
+static void* batch_worker(void *arg) {
+    struct Batch_worker *worker = arg;
+    struct Batch_pool *pool = worker->pool;
+    struct Search_info *si = malloc(sizeof(struct Search_info));
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->input_done)
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        if (pool->queued == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        --pool->queued;
+        pthread_mutex_unlock(&pool->lock);
+
+        u64 seq = take_task(pool, worker->id);
+        struct Batch_task *task = &pool->tasks[seq % pool->window];
+        analyze(task, si, pool->limits);
+
+        pthread_mutex_lock(&pool->lock);
+        task->done = true;
+        pool->total_nodes += si->nodes;
+        flush_results(pool);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    free(si);
+    return NULL;
+}
+
+static bool skip_line(const char *line, size_t len) {
+    size_t i = 0;
+    while (i < len && isspace((unsigned char) line[i]))
+        ++i;
+    return i == len || line[i] == '#';
+}
+
+bool batch_analyze(const char *in_path, const char *out_path, struct Search_limits limits, int num_threads) {
+    struct Mapped_file in;
+    if (!map_file(in_path, &in)) {
+        fprintf(stderr, "Could not open %s\n", in_path);
+        return false;
+    }
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s\n", out_path);
+        unmap_file(&in);
+        return false;
+    }
+
+    if (num_threads <= 0)
+        num_threads = 1;
+    if (!limits.depth && !limits.nodes && !limits.movetime)
+        limits.depth = BATCH_DEFAULT_DEPTH;
+
+    struct Batch_pool pool = {0};
+    pool.limits = limits;
+    pool.num_threads = num_threads;
+    pool.window = (u64) num_threads * WINDOW_PER_THREAD;
+    pool.tasks = calloc(pool.window, sizeof(struct Batch_task));
+    pool.queues = calloc(num_threads, sizeof(struct Task_queue));
+    pool.out = out;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work_available, NULL);
+    pthread_cond_init(&pool.space_available, NULL);
+
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    struct Batch_worker *workers = malloc(num_threads * sizeof(struct Batch_worker));
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+        pool.queues[i].items = malloc(pool.window * sizeof(u64));
+    }
+
+    long long start_time = get_time_ms();
+    for (int i = 0; i < num_threads; ++i) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        int rc = pthread_create(&threads[i], NULL, batch_worker, &workers[i]);
+        if (rc) {
+            fprintf(stderr, "Non-zero return address when spawning thread: rc %d\n", rc);
+            exit(-1);
+        }
+    }
+
+    const char *cursor = in.data;
+    const char *line;
+    size_t len;
+    while (next_line(&cursor, in.data + in.size, &line, &len)) {
+        if (skip_line(line, len))
+            continue;
+
+        pthread_mutex_lock(&pool.lock);
+        while (pool.next_seq - pool.next_output >= pool.window)
+            pthread_cond_wait(&pool.space_available, &pool.lock);
+        u64 seq = pool.next_seq++;
+        pthread_mutex_unlock(&pool.lock);
+
+        //The slot is free: its previous task has been written.
+        pool.tasks[seq % pool.window].line = line;
+        pool.tasks[seq % pool.window].len = len;
+        queue_push(&pool, &pool.queues[seq % num_threads], seq);
+
+        pthread_mutex_lock(&pool.lock);
+        ++pool.queued;
+        pthread_cond_signal(&pool.work_available);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.input_done = true;
+    pthread_cond_broadcast(&pool.work_available);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+    long long elapsed = get_time_ms() - start_time;
+
+    fprintf(stderr, "Positions: %llu, time (ms): %lld, nodes: %llu, nps: %llu\n",
+            (unsigned long long) pool.next_output, elapsed, (unsigned long long) pool.total_nodes,
+            (unsigned long long) (pool.total_nodes * 1000 / (elapsed > 0 ? elapsed : 1)));
+
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_mutex_destroy(&pool.queues[i].lock);
+        free(pool.queues[i].items);
+    }
+    pthread_cond_destroy(&pool.space_available);
+    pthread_cond_destroy(&pool.work_available);
+    pthread_mutex_destroy(&pool.lock);
+    free(workers);
+    free(threads);
+    free(pool.queues);
+    free(pool.tasks);
+    unmap_file(&in);
+    if (out != stdout)
+        fclose(out);
+    return true;
+}
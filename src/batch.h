@@ -0,0 +1,17 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "search.h"
+
+//Depth searched per position when no limit is given.
+#define BATCH_DEFAULT_DEPTH 6
+
+/*
+    Analyzes every position of an EPD (or FEN) file with num_threads threads and writes one EPD line
+    per position to out_path (stdout if NULL), in the order of the input:
+        <position> bm <move>; ce <score>; acd <depth>; acn <nodes>; pv <moves>; [id "<id>";]
+    Moves are in UCI notation. Returns false if a file can't be opened.
+*/
+bool batch_analyze(const char *in_path, const char *out_path, struct Search_limits limits, int num_threads);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#define BENCH_DEFAULT_DEPTH 4
+//Each thread has its own transposition table of this size, cleared before every position.
+#define BENCH_DEFAULT_HASH_MB 16
+
+//Searches a fixed set of positions to the given depth, spread over num_threads threads,
+//and prints the total node count (the bench signature), the time taken and the NPS.
+//The signature is only comparable between runs with the same depth and hash size.
+void bench(int depth, int num_threads, int hash_mb);
+
+#endif
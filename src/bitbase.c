@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitbase.h"
+#include "bitboard.h"
+#include "position.h"
+#include "tables.h"
+
+/*
+    KPK bitbase, generated at startup by iterative retrograde analysis.
+    Positions are normalized so that the pawn is white and on files A-D. An index is made up of
+    the white king square (6 bits), the black king square (6 bits), the side to move (1 bit),
+    the pawn file (2 bits) and the pawn rank, RANK_2 to RANK_7 (6 values).
+    The result is stored as one bit per position (set if white wins), which takes 24 KB.
+*/
+#define KPK_SIZE (2 * 24 * 64 * 64)
+
+//Results used during generation, combined as bit flags when looking at the successors of a position.
+enum Kpk_gen_result {
+    GEN_INVALID = 0,
+    GEN_UNKNOWN = 1,
+    GEN_DRAW = 2,
+    GEN_WIN = 4
+};
+
+static uint32_t kpk_bitbase[KPK_SIZE / 32];
+
+static unsigned kpk_index(enum Side stm, enum Square bksq, enum Square wksq, enum Square psq) {
+    return wksq | (bksq << 6) | (stm << 12) | (sq_file(psq) << 13) | ((RANK_7 - sq_rank(psq)) << 15);
+}
+
+static bool adjacent_or_equal(enum Square a, enum Square b) {
+    return a == b || is_set(b, attack_set.king[a]);
+}
+
+static unsigned char initial_result(unsigned idx) {
+    enum Square wksq = (enum Square) (idx & 0x3F);
+    enum Square bksq = (enum Square) ((idx >> 6) & 0x3F);
+    enum Side stm = (enum Side) ((idx >> 12) & 1);
+    enum Square psq = file_rank_sq((enum File) ((idx >> 13) & 3), (enum Rank) (RANK_7 - (idx >> 15)));
+
+    //Kings touching, pieces on the same square, or the side not to move in check.
+    if (adjacent_or_equal(wksq, bksq) || wksq == psq || bksq == psq
+        || (stm == WHITE && is_set(bksq, attack_set.pawn[WHITE][psq])))
+        return GEN_INVALID;
+
+    //The pawn promotes safely immediately.
+    if (stm == WHITE && sq_rank(psq) == RANK_7) {
+        enum Square promotion_sq = psq + 8;
+        if (wksq != promotion_sq && bksq != promotion_sq
+            && (!adjacent_or_equal(bksq, promotion_sq) || adjacent_or_equal(wksq, promotion_sq)))
+            return GEN_WIN;
+    }
+
+    //Stalemate, or black captures an undefended pawn.
+    if (stm == BLACK) {
+        u64 black_moves = attack_set.king[bksq] & ~(attack_set.king[wksq] | attack_set.pawn[WHITE][psq]);
+        if (!black_moves || (attack_set.king[bksq] & ~attack_set.king[wksq] & set_bit(psq)))
+            return GEN_DRAW;
+    }
+
+    return GEN_UNKNOWN;
+}
+
+//Combines the results of all the successors of an unknown position. White needs one winning move,
+//black needs one move that doesn't lose.
+static unsigned char classify(const unsigned char *db, unsigned idx) {
+    enum Square wksq = (enum Square) (idx & 0x3F);
+    enum Square bksq = (enum Square) ((idx >> 6) & 0x3F);
+    enum Side stm = (enum Side) ((idx >> 12) & 1);
+    enum Square psq = file_rank_sq((enum File) ((idx >> 13) & 3), (enum Rank) (RANK_7 - (idx >> 15)));
+
+    unsigned char r = GEN_INVALID;
+    if (stm == WHITE) {
+        u64 king_moves = attack_set.king[wksq];
+        while (king_moves)
+            r |= db[kpk_index(BLACK, bksq, pop_lsb(&king_moves), psq)];
+
+        //Pushes onto a king square give an invalid index, so they don't contribute.
+        if (sq_rank(psq) < RANK_7)
+            r |= db[kpk_index(BLACK, bksq, wksq, psq + 8)];
+        if (sq_rank(psq) == RANK_2 && psq + 8 != wksq && psq + 8 != bksq)
+            r |= db[kpk_index(BLACK, bksq, wksq, psq + 16)];
+
+        return (r & GEN_WIN) ? GEN_WIN : (r & GEN_UNKNOWN) ? GEN_UNKNOWN : GEN_DRAW;
+    }
+
+    u64 king_moves = attack_set.king[bksq];
+    while (king_moves)
+        r |= db[kpk_index(WHITE, pop_lsb(&king_moves), wksq, psq)];
+
+    return (r & GEN_DRAW) ? GEN_DRAW : (r & GEN_UNKNOWN) ? GEN_UNKNOWN : GEN_WIN;
+}
+
+void kpk_init(void) {
+    unsigned char *db = malloc(KPK_SIZE);
+
+    for (unsigned idx = 0; idx < KPK_SIZE; ++idx)
+        db[idx] = initial_result(idx);
+
+    //Iterate until no unknown position can be resolved anymore. The remaining ones are draws.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned idx = 0; idx < KPK_SIZE; ++idx) {
+            if (db[idx] == GEN_UNKNOWN && (db[idx] = classify(db, idx)) != GEN_UNKNOWN)
+                changed = true;
+        }
+    }
+
+    memset(kpk_bitbase, 0, sizeof(kpk_bitbase));
+    for (unsigned idx = 0; idx < KPK_SIZE; ++idx) {
+        if (db[idx] == GEN_WIN)
+            kpk_bitbase[idx / 32] |= 1U << (idx % 32);
+    }
+
+    free(db);
+}
+
+bool kpk_probe(enum Side side_to_move, enum Square white_king_sq, enum Square pawn_sq, enum Square black_king_sq) {
+    //Mirror pawns on files E-H to files A-D.
+    if (sq_file(pawn_sq) > FILE_D) {
+        white_king_sq ^= 7;
+        black_king_sq ^= 7;
+        pawn_sq ^= 7;
+    }
+
+    unsigned idx = kpk_index(side_to_move, black_king_sq, white_king_sq, pawn_sq);
+    return kpk_bitbase[idx / 32] & (1U << (idx % 32));
+}
+
+enum Kpk_result kpk_probe_position(const struct Position *pos) {
+    if (popcount(pos_occupancy(pos)) != 3)
+        return KPK_NONE;
+
+    enum Side strong = pos->piece_bb[PAWN][WHITE] ? WHITE : BLACK;
+    if (!pos->piece_bb[PAWN][strong])
+        return KPK_NONE;
+
+    enum Square strong_king = lsb(pos->piece_bb[KING][strong]);
+    enum Square weak_king = lsb(pos->piece_bb[KING][!strong]);
+    enum Square pawn = lsb(pos->piece_bb[PAWN][strong]);
+    enum Side stm = pos->side_to_move;
+
+    //Flip the board vertically so that the pawn is white.
+    if (strong == BLACK) {
+        strong_king ^= 56;
+        weak_king ^= 56;
+        pawn ^= 56;
+        stm = !stm;
+    }
+
+    return kpk_probe(stm, strong_king, pawn, weak_king) ? KPK_WIN : KPK_DRAW;
+}
@@ -0,0 +1,25 @@
+#ifndef BITBASE_H
+#define BITBASE_H
+
+#include <stdbool.h>
+
+#include "types.h"
+
+struct Position;
+
+enum Kpk_result {
+    KPK_NONE, //The position is not a king and pawn versus king endgame.
+    KPK_DRAW,
+    KPK_WIN   //Win for the side with the pawn.
+};
+
+//Generates the KPK bitbase. Must be called after the attack sets have been initialized.
+void kpk_init(void);
+
+//Probes with the pawn side normalized to white. Returns true if white wins.
+bool kpk_probe(enum Side side_to_move, enum Square white_king_sq, enum Square pawn_sq, enum Square black_king_sq);
+
+//Returns the bitbase result if the position is a KPK endgame, and KPK_NONE otherwise.
+enum Kpk_result kpk_probe_position(const struct Position *pos);
+
+#endif
@@ -56,6 +56,10 @@ static inline enum Square msb(u64 bb) {
     return ((enum Square) (63U ^ (unsigned) __builtin_clzll(bb)));
 }
 
+static inline int popcount(u64 bb) {
+    return __builtin_popcountll(bb);
+}
+
 #elif defined(_MSC_VER) //MSVC
 
 static inline enum Square lsb(u64 bb) {
@@ -73,6 +77,10 @@ static inline enum Square msb(u64 bb) {
     return (enum Square) idx;
 }
 
+static inline int popcount(u64 bb) {
+    return (int) __popcnt64(bb);
+}
+
 #endif //GCC defined
 
 static inline enum Square pop_lsb(u64 *bb) {
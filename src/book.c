@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "book.h"
+#include "movegen.h"
+#include "zobrist.h"
+
+#define BOOK_ENTRY_SZ 16
+#define MAX_NUM_MOVES 256
+
+//A Polyglot book is a sorted array of 16 byte big-endian entries:
+//key (8 bytes), move (2 bytes), weight (2 bytes) and learn (4 bytes).
+//The entries are read directly from the mapping, without copying the book to the heap.
+struct Book {
+    const unsigned char *data;
+    size_t map_size;
+    size_t num_entries;
+};
+
+static struct Book book = { NULL, 0, 0 };
+
+//State for the xorshift generator used to pick weighted random moves.
+static u64 rng_state;
+
+static u64 read_be(const unsigned char *p, int num_bytes) {
+    u64 value = 0;
+    for (int i = 0; i < num_bytes; ++i)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+static inline u64 entry_key(size_t idx) {
+    return read_be(book.data + idx * BOOK_ENTRY_SZ, 8);
+}
+
+static inline unsigned entry_move(size_t idx) {
+    return (unsigned) read_be(book.data + idx * BOOK_ENTRY_SZ + 8, 2);
+}
+
+static inline unsigned entry_weight(size_t idx) {
+    return (unsigned) read_be(book.data + idx * BOOK_ENTRY_SZ + 10, 2);
+}
+
+static u64 next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+bool book_open(const char *path) {
+    book_close();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BOOK_ENTRY_SZ) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //The mapping stays valid after the file descriptor is closed.
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    book.data = data;
+    book.map_size = st.st_size;
+    book.num_entries = st.st_size / BOOK_ENTRY_SZ;
+    rng_state = (u64) time(NULL) | 1ULL;
+
+    return true;
+}
+
+void book_close(void) {
+    if (book.data != NULL)
+        munmap((void*) book.data, book.map_size);
+
+    book.data = NULL;
+    book.map_size = 0;
+    book.num_entries = 0;
+}
+
+bool book_loaded(void) {
+    return book.data != NULL;
+}
+
+//Index of the first entry with a key not less than key.
+static size_t lower_bound(u64 key) {
+    size_t lo = 0;
+    size_t hi = book.num_entries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entry_key(mid) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+    Finds the legal move corresponding to a Polyglot move.
+    Polyglot moves store to file, to row, from file, from row and promotion piece in 3 bits each.
+    Castling is encoded as the king capturing its own rook, e.g. e1h1 for white short castling.
+    Matching against the generated moves means that corrupt entries or key collisions can never
+    make us play an illegal move.
+*/
+static bool decode_move(unsigned pg_move, struct Position *pos, struct Move *move) {
+    enum Square to = file_rank_sq(pg_move & 7, (pg_move >> 3) & 7);
+    enum Square from = file_rank_sq((pg_move >> 6) & 7, (pg_move >> 9) & 7);
+    unsigned promotion = (pg_move >> 12) & 7;
+    enum Piece_type promotion_type = promotion ? (enum Piece_type) promotion : PT_NULL;
+
+    if (to_piece_type(pos->piece_list[from]) == KING) {
+        if (from == e1 && to == h1) to = g1;
+        else if (from == e1 && to == a1) to = c1;
+        else if (from == e8 && to == h8) to = g8;
+        else if (from == e8 && to == a8) to = c8;
+    }
+
+    struct Move move_list[MAX_NUM_MOVES];
+    int num_moves = generate_moves(move_list, pos);
+    for (int i = 0; i < num_moves; ++i) {
+        if (move_list[i].from_sq == from && move_list[i].to_sq == to
+            && move_list[i].promotion_type == promotion_type) {
+            *move = move_list[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool book_probe(struct Position *pos, bool best_only, struct Move *move) {
+    if (!book_loaded())
+        return false;
+
+    u64 key = compute_key(pos);
+    size_t first = lower_bound(key);
+
+    unsigned total_weight = 0;
+    unsigned best_weight = 0;
+    size_t best_idx = first;
+    size_t end = first;
+    for (; end < book.num_entries && entry_key(end) == key; ++end) {
+        unsigned weight = entry_weight(end);
+        total_weight += weight;
+        if (weight > best_weight) {
+            best_weight = weight;
+            best_idx = end;
+        }
+    }
+
+    if (end == first)
+        return false;
+
+    size_t chosen = best_idx;
+    if (!best_only && total_weight > 0) {
+        unsigned r = (unsigned) (next_random() % total_weight);
+        for (size_t i = first; i < end; ++i) {
+            unsigned weight = entry_weight(i);
+            if (r < weight) {
+                chosen = i;
+                break;
+            }
+            r -= weight;
+        }
+    }
+
+    return decode_move(entry_move(chosen), pos, move);
+}
@@ -0,0 +1,18 @@
+#ifndef BOOK_H
+#define BOOK_H
+
+#include <stdbool.h>
+
+#include "position.h"
+
+//Opens a Polyglot (.bin) opening book. The file is memory mapped read-only, any previously opened book is closed.
+bool book_open(const char *path);
+void book_close(void);
+bool book_loaded(void);
+
+//Looks up the position in the book. If there are book moves, one of them is stored in move and true is returned.
+//With best_only set the move with the highest weight is chosen, otherwise a move is picked at random
+//with a probability proportional to its weight.
+bool book_probe(struct Position *pos, bool best_only, struct Move *move);
+
+#endif
@@ -0,0 +1,250 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bitboard.h"
+#include "datagen.h"
+#include "movegen.h"
+#include "packed.h"
+#include "search.h"
+#include "tt.h"
+
+#define MAX_NUM_MOVES 256
+
+//Random moves played from the initial position, so that the games don't repeat.
+#define RANDOM_PLIES 8
+#define MAX_GAME_PLIES 400
+//A game is adjudicated once the score stays beyond WIN_SCORE for WIN_PLIES plies in a row.
+#define WIN_SCORE 2000
+#define WIN_PLIES 6
+//Records collected by a thread before they are written to the file.
+#define WRITE_BUFFER_RECORDS 8192
+#define PROGRESS_INTERVAL_GAMES 100
+
+static const char *startpos_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+struct Datagen_state {
+    int num_games;
+    u64 nodes;
+    struct Packed_writer writer;
+
+    pthread_mutex_t lock;
+    int next_game;
+    int games_done;
+    u64 positions;
+    long long start_time;
+};
+
+struct Datagen_worker {
+    struct Datagen_state *state;
+    int id;
+};
+
+//xorshift64*, one generator per thread.
+static u64 next_random(u64 *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static bool insufficient_material(const struct Position *pos) {
+    u64 pawns_rooks_queens = 0;
+    for (int side = WHITE; side <= BLACK; ++side)
+        pawns_rooks_queens |= pos->piece_bb[PAWN][side] | pos->piece_bb[ROOK][side] | pos->piece_bb[QUEEN][side];
+    return !pawns_rooks_queens && popcount(pos_occupancy(pos)) <= 3;
+}
+
+//Counts the earlier occurrences of the last position since the last irreversible move.
+static int repetitions(const u64 *keys, int num_keys, unsigned half_move_clock) {
+    int count = 0;
+    for (int i = num_keys - 3; i >= 0 && i >= num_keys - 1 - (int) half_move_clock; i -= 2)
+        count += keys[i] == keys[num_keys - 1];
+    return count;
+}
+
+static void flush_records(struct Datagen_state *state, struct Packed_position *buffer, size_t *num_records) {
+    if (*num_records == 0)
+        return;
+    pthread_mutex_lock(&state->lock);
+    packed_writer_write(&state->writer, buffer, *num_records);
+    pthread_mutex_unlock(&state->lock);
+    *num_records = 0;
+}
+
+/*
+    Plays one game and stores its quiet positions in records. Returns the number of positions
+    stored, -1 if the game ended during the random opening. The table is cleared before the first
+    search, so no game sees the entries of the previous one.
+*/
+static int play_game(struct Datagen_state *state, struct Search_info *si, struct Tt *tt, u64 *rng,
+                     struct Packed_position *records) {
+    struct Move move_list[MAX_NUM_MOVES];
+    u64 keys[MAX_GAME_PLIES + 1];
+    struct Position pos = pos_from_FEN(startpos_FEN);
+    struct Search_limits limits = { .depth = 0, .movetime = 0, .nodes = state->nodes };
+    enum Packed_result result = PACKED_DRAW;
+    int num_records = 0;
+    int win_plies = 0, loss_plies = 0;
+
+    for (int ply = 0; ply < RANDOM_PLIES; ++ply) {
+        int num_moves = generate_moves(move_list, &pos);
+        if (num_moves == 0)
+            return -1;
+        //The moves of a game are never unmade, so no move states are kept.
+        make_move(move_list[next_random(rng) % num_moves], &pos, NULL);
+    }
+
+    tt_clear(tt, 1);
+    int num_keys = 0;
+    keys[num_keys++] = pos.key;
+    for (int ply = 0; ply < MAX_GAME_PLIES; ++ply) {
+        if (generate_moves(move_list, &pos) == 0) {
+            if (pos_in_check(&pos))
+                result = pos.side_to_move == WHITE ? PACKED_LOSS : PACKED_WIN;
+            break;
+        }
+        if (pos.half_move_clock >= 100 || insufficient_material(&pos)
+            || repetitions(keys, num_keys, pos.half_move_clock) >= 2)
+            break;
+
+        struct Move best_move;
+        search_info_init(si, limits);
+        si->silent = true;
+        si->tt = tt;
+        search_info_set_history(si, keys, num_keys - 1);
+        int score = search(&pos, si, &best_move);
+        search_info_destroy(si);
+        int white_score = pos.side_to_move == WHITE ? score : -score;
+
+        bool noisy = pos.piece_list[best_move.to_sq] != PIECE_EMPTY || best_move.en_passant
+                     || best_move.promotion_type != PT_NULL;
+        if (!noisy && !pos_in_check(&pos)) {
+            struct Packed_position *rec = &records[num_records++];
+            pack_position(&pos, rec);
+            rec->score = (int16_t) (white_score > INT16_MAX ? INT16_MAX : white_score < INT16_MIN ? INT16_MIN : white_score);
+        }
+
+        win_plies = white_score >= WIN_SCORE ? win_plies + 1 : 0;
+        loss_plies = white_score <= -WIN_SCORE ? loss_plies + 1 : 0;
+        if (win_plies >= WIN_PLIES || loss_plies >= WIN_PLIES) {
+            result = win_plies >= WIN_PLIES ? PACKED_WIN : PACKED_LOSS;
+            break;
+        }
+
+        make_move(best_move, &pos, NULL);
+        keys[num_keys++] = pos.key;
+    }
+
+    for (int i = 0; i < num_records; ++i)
+        records[i].result = (uint8_t) result;
+    return num_records;
+}
+
+static void* datagen_worker(void *arg) {
+    struct Datagen_worker *worker = arg;
+    struct Datagen_state *state = worker->state;
+    struct Search_info *si = malloc(sizeof(struct Search_info));
+    //Each thread searches with its own table.
+    struct Tt tt = {0};
+    if (!tt_resize(&tt, DATAGEN_HASH_MB, 1)) {
+        fprintf(stderr, "Could not allocate the transposition table\n");
+        exit(-1);
+    }
+    struct Packed_position *game_records = malloc(MAX_GAME_PLIES * sizeof(struct Packed_position));
+    struct Packed_position *buffer = malloc(WRITE_BUFFER_RECORDS * sizeof(struct Packed_position));
+    size_t num_buffered = 0;
+    u64 rng = (u64) get_time_ms() * 0x9E3779B97F4A7C15ULL ^ (u64) (worker->id + 1) * 0xD1B54A32D192ED03ULL;
+
+    for (;;) {
+        pthread_mutex_lock(&state->lock);
+        bool done = state->next_game >= state->num_games || state->writer.error;
+        ++state->next_game;
+        pthread_mutex_unlock(&state->lock);
+        if (done)
+            break;
+
+        int num_records;
+        while ((num_records = play_game(state, si, &tt, &rng, game_records)) < 0)
+            ;
+
+        if (num_buffered + num_records > WRITE_BUFFER_RECORDS)
+            flush_records(state, buffer, &num_buffered);
+        memcpy(&buffer[num_buffered], game_records, num_records * sizeof(struct Packed_position));
+        num_buffered += num_records;
+
+        pthread_mutex_lock(&state->lock);
+        state->positions += num_records;
+        if (++state->games_done % PROGRESS_INTERVAL_GAMES == 0) {
+            long long elapsed = get_time_ms() - state->start_time;
+            fprintf(stderr, "Games: %d, positions: %llu, positions/second: %llu\n", state->games_done,
+                    (unsigned long long) state->positions,
+                    (unsigned long long) (state->positions * 1000 / (elapsed > 0 ? elapsed : 1)));
+        }
+        pthread_mutex_unlock(&state->lock);
+    }
+
+    flush_records(state, buffer, &num_buffered);
+    free(buffer);
+    free(game_records);
+    tt_free(&tt);
+    free(si);
+    return NULL;
+}
+
+bool datagen(const char *out_path, int num_games, u64 nodes, int num_threads) {
+    struct Datagen_state state = {0};
+    if (!packed_writer_open(&state.writer, out_path)) {
+        fprintf(stderr, "Could not open %s\n", out_path);
+        return false;
+    }
+
+    if (num_threads <= 0)
+        num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0)
+        num_threads = 1;
+    if (num_games <= 0)
+        num_games = DATAGEN_DEFAULT_GAMES;
+    if (nodes == 0)
+        nodes = DATAGEN_DEFAULT_NODES;
+
+    state.num_games = num_games;
+    state.nodes = nodes;
+    pthread_mutex_init(&state.lock, NULL);
+
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    struct Datagen_worker *workers = malloc(num_threads * sizeof(struct Datagen_worker));
+    state.start_time = get_time_ms();
+    for (int i = 0; i < num_threads; ++i) {
+        workers[i].state = &state;
+        workers[i].id = i;
+        int rc = pthread_create(&threads[i], NULL, datagen_worker, &workers[i]);
+        if (rc) {
+            fprintf(stderr, "Non-zero return address when spawning thread: rc %d\n", rc);
+            exit(-1);
+        }
+    }
+    for (int i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+    long long elapsed = get_time_ms() - state.start_time;
+    double seconds = (elapsed > 0 ? elapsed : 1) / 1000.0;
+
+    printf("Games              : %d\n", state.games_done);
+    printf("Positions          : %llu\n", (unsigned long long) state.positions);
+    printf("Threads            : %d\n", num_threads);
+    printf("Total time (ms)    : %lld\n", elapsed);
+    printf("Positions/second   : %llu\n", (unsigned long long) (state.positions / seconds));
+    printf("Positions/s/thread : %llu\n", (unsigned long long) (state.positions / seconds / num_threads));
+
+    bool ok = packed_writer_close(&state.writer);
+    if (!ok)
+        fprintf(stderr, "Error writing %s\n", out_path);
+    pthread_mutex_destroy(&state.lock);
+    free(workers);
+    free(threads);
+    return ok;
+}
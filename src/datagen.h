@@ -0,0 +1,23 @@
+#ifndef DATAGEN_H
+#define DATAGEN_H
+
+#include <stdbool.h>
+
+#include "types.h"
+
+#define DATAGEN_DEFAULT_GAMES 1000
+#define DATAGEN_DEFAULT_NODES 5000
+//Size of the transposition table of each thread. Searches of a few thousand nodes don't fill more,
+//and a larger table only costs cache misses.
+#define DATAGEN_HASH_MB 1
+
+/*
+    Plays num_games games of fixed-node self-play on num_threads threads (all cores if <= 0),
+    starting from the initial position after a few random moves. Quiet positions are written to
+    out_path as a file of packed positions (see packed.h), labeled with the search score and the game
+    result. Positions in check and positions where the best move is a capture or a promotion are
+    skipped. Returns false if the file can't be written.
+*/
+bool datagen(const char *out_path, int num_games, u64 nodes, int num_threads);
+
+#endif
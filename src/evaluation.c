@@ -1,30 +1,134 @@
 #include <stdlib.h>
 
+#include "bitbase.h"
 #include "bitboard.h"
 #include "evaluation.h"
 #include "position.h"
 #include "types.h"
 
-//Indexing this array by Piece_type gives the value in centipawns for that piece
-static const int piece_value[] = {100, 300, 300, 500, 900, 100000, 0};
+//The king is always on the board, so its value only has to be large.
+#define KING_VALUE 100000
+
+/*
+    All tunable evaluation parameters, laid out as described in evaluation.h.
+    tools/tune.c writes this array with tuned values.
+*/
+int eval_params[NUM_EVAL_PARAMS] = {
+    //Piece values: pawn, knight, bishop, rook, queen
+    100, 300, 300, 500, 900,
+    //Piece-square tables from the point of view of white, a1 first
+    //Pawn
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    //Knight
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    //Bishop
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    //Rook
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    //Queen
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    //King
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+//KPK wins are scored below a queen, so that promoting is always preferred over keeping the pawn.
+static int kpk_win_score(const struct Position *pos, enum Side strong) {
+    enum Square pawn_sq = lsb(pos->piece_bb[PAWN][strong]);
+    int relative_rank = (strong == WHITE) ? sq_rank(pawn_sq) : RANK_8 - sq_rank(pawn_sq);
+    return eval_params[PARAM_PIECE_VALUE(QUEEN)] - 200 + 20 * relative_rank;
+}
+
+//Squares are mirrored vertically for black, so that the tables are shared by both sides.
+static inline enum Square relative_sq(enum Square sq, enum Side side) {
+    return (side == WHITE) ? sq : (enum Square) (sq ^ 56);
+}
 
 int evaluate_position(const struct Position *pos, enum Side side) {
+    enum Kpk_result kpk = kpk_probe_position(pos);
+    if (kpk == KPK_DRAW)
+        return 0;
+    if (kpk == KPK_WIN) {
+        enum Side strong = pos->piece_bb[PAWN][WHITE] ? WHITE : BLACK;
+        return (strong == side) ? kpk_win_score(pos, strong) : -kpk_win_score(pos, strong);
+    }
+
     int score = 0;
-    //Material count in centipawns
+    //Material and piece placement in centipawns
     for (enum Piece_type pt = PAWN; pt <= KING; ++pt) {
+        int value = (pt == KING) ? KING_VALUE : eval_params[PARAM_PIECE_VALUE(pt)];
         u64 white_bitboard = pos->piece_bb[pt][WHITE];
         while (white_bitboard) {
-            score += piece_value[pt];
-            pop_lsb(&white_bitboard);
+            enum Square sq = pop_lsb(&white_bitboard);
+            score += value + eval_params[PARAM_PSQT(pt, sq)];
         }
         u64 black_bitboard = pos->piece_bb[pt][BLACK];
         while (black_bitboard) {
-            score -= piece_value[pt];
-            pop_lsb(&black_bitboard);
+            enum Square sq = pop_lsb(&black_bitboard);
+            score -= value + eval_params[PARAM_PSQT(pt, relative_sq(sq, BLACK))];
         }
     }
 
     int factor = side == WHITE ? 1 : -1;
 
     return factor * score;
-}
\ No newline at end of file
+}
+
+int eval_terms(const struct Position *pos, struct Eval_term *terms) {
+    int num_terms = 0;
+    for (enum Piece_type pt = PAWN; pt <= KING; ++pt) {
+        int count = popcount(pos->piece_bb[pt][WHITE]) - popcount(pos->piece_bb[pt][BLACK]);
+        if (pt != KING && count != 0)
+            terms[num_terms++] = (struct Eval_term) { PARAM_PIECE_VALUE(pt), (int16_t) count };
+
+        for (enum Side side = WHITE; side <= BLACK; ++side) {
+            u64 bitboard = pos->piece_bb[pt][side];
+            while (bitboard) {
+                enum Square sq = pop_lsb(&bitboard);
+                terms[num_terms++] = (struct Eval_term) { PARAM_PSQT(pt, relative_sq(sq, side)), side == WHITE ? 1 : -1 };
+            }
+        }
+    }
+    return num_terms;
+}
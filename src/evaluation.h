@@ -1,8 +1,40 @@
 #ifndef EVALUATION_H
 #define EVALUATION_H
 
+#include <stdint.h>
+
+#include "types.h"
+
 struct Position;
 
+/*
+    The evaluation is linear in its parameters, which are kept in one vector so that they can be tuned:
+    the values of the pieces from pawn to queen, followed by a piece-square table for every piece type,
+    indexed by the square from the point of view of the side of the piece.
+*/
+#define NUM_PIECE_VALUES 5
+#define PARAM_PIECE_VALUE(pt) (pt)
+#define PARAM_PSQT(pt, sq) (NUM_PIECE_VALUES + 64 * (pt) + (sq))
+#define NUM_EVAL_PARAMS (NUM_PIECE_VALUES + 6 * 64)
+
+extern int eval_params[NUM_EVAL_PARAMS];
+
 int evaluate_position(const struct Position *pos, enum Side side);
 
-#endif
\ No newline at end of file
+//A parameter and how many times it is counted, positive for white and negative for black.
+struct Eval_term {
+    uint16_t param;
+    int16_t coeff;
+};
+
+//A term per piece value and per piece on the board.
+#define MAX_EVAL_TERMS (NUM_PIECE_VALUES + 32)
+
+/*
+    Writes the terms of the evaluation of pos to terms and returns their number. The sum of
+    coeff * eval_params[param] over the terms equals evaluate_position from the point of view of white,
+    except for KPK endgames, which are scored from the bitbase.
+*/
+int eval_terms(const struct Position *pos, struct Eval_term *terms);
+
+#endif
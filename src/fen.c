@@ -0,0 +1,299 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "attacks.h"
+#include "bitboard.h"
+#include "fen.h"
+#include "search.h"
+#include "zobrist.h"
+
+#define MAX_CLOCK_DIGITS 6
+
+static const char *error_strs[] = {
+    "ok",
+    "invalid piece placement",
+    "each side needs exactly one king",
+    "pawn on the first or last rank",
+    "invalid side to move",
+    "invalid castling rights",
+    "invalid en passant square",
+    "invalid move counter",
+    "side not to move is in check"
+};
+
+//Piece for every FEN character, PIECE_EMPTY for characters that aren't pieces.
+static const enum Piece piece_from_char[256] = {
+    ['P'] = WHITE_PAWN, ['N'] = WHITE_KNIGHT, ['B'] = WHITE_BISHOP,
+    ['R'] = WHITE_ROOK, ['Q'] = WHITE_QUEEN, ['K'] = WHITE_KING,
+    ['p'] = BLACK_PAWN, ['n'] = BLACK_KNIGHT, ['b'] = BLACK_BISHOP,
+    ['r'] = BLACK_ROOK, ['q'] = BLACK_QUEEN, ['k'] = BLACK_KING
+};
+
+const char *fen_error_str(enum Fen_error err) {
+    return error_strs[err];
+}
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static inline bool at_field_end(const char *p, const char *end) {
+    return p == end || is_blank(*p) || *p == '\n' || *p == '\r' || *p == '\0';
+}
+
+static inline const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && is_blank(*p))
+        ++p;
+    return p;
+}
+
+static enum Fen_error parse_board(const char **str, const char *end, struct Position *pos) {
+    const char *p = *str;
+    int rank = RANK_8;
+    int file = FILE_A;
+
+    for (; !at_field_end(p, end); ++p) {
+        char c = *p;
+        if (c == '/') {
+            if (file != 8 || rank == RANK_1)
+                return FEN_BAD_BOARD;
+            --rank;
+            file = FILE_A;
+        } else if (c >= '1' && c <= '8') {
+            file += c - '0';
+            if (file > 8)
+                return FEN_BAD_BOARD;
+        } else {
+            enum Piece piece = piece_from_char[(unsigned char) c];
+            if (piece == PIECE_EMPTY || file >= 8)
+                return FEN_BAD_BOARD;
+            enum Square sq = file_rank_sq((enum File) file, (enum Rank) rank);
+            pos->piece_list[sq] = piece;
+            pos->piece_bb[to_piece_type(piece)][piece_color(piece)] |= set_bit(sq);
+            pos->occupied_squares[piece_color(piece)] |= set_bit(sq);
+            ++file;
+        }
+    }
+
+    if (rank != RANK_1 || file != 8)
+        return FEN_BAD_BOARD;
+    if (popcount(pos->piece_bb[KING][WHITE]) != 1 || popcount(pos->piece_bb[KING][BLACK]) != 1)
+        return FEN_BAD_KINGS;
+    if ((pos->piece_bb[PAWN][WHITE] | pos->piece_bb[PAWN][BLACK]) & (Rank1BB | Rank8BB))
+        return FEN_BAD_PAWNS;
+
+    *str = p;
+    return FEN_OK;
+}
+
+static enum Fen_error parse_castling(const char **str, const char *end, struct Position *pos) {
+    const char *p = *str;
+    if (p < end && *p == '-') {
+        *str = p + 1;
+        return at_field_end(*str, end) ? FEN_OK : FEN_BAD_CASTLING;
+    }
+
+    for (; !at_field_end(p, end); ++p) {
+        enum Side side = (*p == 'K' || *p == 'Q') ? WHITE : BLACK;
+        enum Rank back_rank = (side == WHITE) ? RANK_1 : RANK_8;
+        enum Piece king = to_colored_piece(KING, side);
+        enum Piece rook = to_colored_piece(ROOK, side);
+        if (pos->piece_list[file_rank_sq(FILE_E, back_rank)] != king)
+            return FEN_BAD_CASTLING;
+
+        switch (*p) {
+            case 'K':
+            case 'k':
+                if (pos->piece_list[file_rank_sq(FILE_H, back_rank)] != rook)
+                    return FEN_BAD_CASTLING;
+                pos->can_kingside_castle[side] = true;
+                break;
+            case 'Q':
+            case 'q':
+                if (pos->piece_list[file_rank_sq(FILE_A, back_rank)] != rook)
+                    return FEN_BAD_CASTLING;
+                pos->can_queenside_castle[side] = true;
+                break;
+            default:
+                return FEN_BAD_CASTLING;
+        }
+    }
+
+    if (p == *str)
+        return FEN_BAD_CASTLING;
+    *str = p;
+    return FEN_OK;
+}
+
+static enum Fen_error parse_ep(const char **str, const char *end, struct Position *pos) {
+    const char *p = *str;
+    if (p < end && *p == '-') {
+        *str = p + 1;
+        return at_field_end(*str, end) ? FEN_OK : FEN_BAD_EP;
+    }
+
+    //The square behind a pawn that just made a double push.
+    char expected_rank = (pos->side_to_move == WHITE) ? '6' : '3';
+    if (end - p < 2 || p[0] < 'a' || p[0] > 'h' || p[1] != expected_rank || !at_field_end(p + 2, end))
+        return FEN_BAD_EP;
+
+    pos->ep_square = file_rank_sq((enum File) (p[0] - 'a'), (enum Rank) (p[1] - '1'));
+    *str = p + 2;
+    return FEN_OK;
+}
+
+//Parses an optional number. Returns false if the field is present but isn't a number.
+static bool parse_clock(const char **str, const char *end, unsigned *value) {
+    const char *p = skip_blanks(*str, end);
+    if (p == end || *p < '0' || *p > '9')
+        return true;
+
+    unsigned result = 0;
+    int digits = 0;
+    for (; !at_field_end(p, end); ++p, ++digits) {
+        if (*p < '0' || *p > '9' || digits >= MAX_CLOCK_DIGITS)
+            return false;
+        result = result * 10 + (unsigned) (*p - '0');
+    }
+
+    *value = result;
+    *str = p;
+    return true;
+}
+
+enum Fen_error fen_parse(const char *str, const char *end, struct Position *pos, const char **next) {
+    enum Fen_error err;
+    memset(pos, 0, sizeof(struct Position));
+    pos->ep_square = SQUARE_EMPTY;
+    pos->fullmove_count = 1;
+
+    const char *p = skip_blanks(str, end);
+    if ((err = parse_board(&p, end, pos)) != FEN_OK)
+        return err;
+
+    p = skip_blanks(p, end);
+    if (p == end || (*p != 'w' && *p != 'b') || !at_field_end(p + 1, end))
+        return FEN_BAD_SIDE;
+    pos->side_to_move = (*p == 'w') ? WHITE : BLACK;
+
+    p = skip_blanks(p + 1, end);
+    if ((err = parse_castling(&p, end, pos)) != FEN_OK)
+        return err;
+
+    p = skip_blanks(p, end);
+    if ((err = parse_ep(&p, end, pos)) != FEN_OK)
+        return err;
+
+    if (!parse_clock(&p, end, &pos->half_move_clock) || !parse_clock(&p, end, &pos->fullmove_count))
+        return FEN_BAD_CLOCK;
+
+    enum Side them = !pos->side_to_move;
+    if (attackers_to(lsb(pos->piece_bb[KING][them]), pos, them))
+        return FEN_IN_CHECK;
+
+    pos->key = compute_key(pos);
+    pos->checkers = compute_checkers(pos);
+    if (next != NULL)
+        *next = p;
+    return FEN_OK;
+}
+
+bool map_file(const char *path, struct Mapped_file *file) {
+    file->data = NULL;
+    file->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    //Empty files can't be mapped, but are valid input.
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    //The file is read front to back once.
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+    file->data = data;
+    file->size = st.st_size;
+    return true;
+}
+
+void unmap_file(struct Mapped_file *file) {
+    if (file->data != NULL)
+        munmap((void*) file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+
+bool next_line(const char **cursor, const char *end, const char **line, size_t *len) {
+    const char *p = *cursor;
+    if (p == NULL || p >= end)
+        return false;
+
+    const char *newline = memchr(p, '\n', end - p);
+    const char *line_end = newline ? newline : end;
+    *cursor = newline ? newline + 1 : end;
+    *line = p;
+    *len = (size_t) (line_end - p);
+    if (*len > 0 && p[*len - 1] == '\r')
+        --*len;
+    return true;
+}
+
+void fen_bench(const char *path) {
+    struct Mapped_file file;
+    if (!map_file(path, &file)) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return;
+    }
+
+    unsigned long long num_positions = 0;
+    unsigned long long num_errors = 0;
+    const char *cursor = file.data;
+    const char *line;
+    size_t len;
+    struct Position pos;
+    u64 checksum = 0;
+
+    long long start_time = get_time_ms();
+    while (next_line(&cursor, file.data + file.size, &line, &len)) {
+        if (len == 0 || line[0] == '#')
+            continue;
+        if (fen_parse(line, line + len, &pos, NULL) == FEN_OK) {
+            ++num_positions;
+            //Keeps the compiler from dropping the parsing.
+            checksum += pos_occupancy(&pos) + pos.side_to_move;
+        } else {
+            ++num_errors;
+        }
+    }
+    long long elapsed = get_time_ms() - start_time;
+    double seconds = (elapsed > 0 ? elapsed : 1) / 1000.0;
+
+    printf("Positions       : %llu\n", num_positions);
+    printf("Errors          : %llu\n", num_errors);
+    printf("Total time (ms) : %lld\n", elapsed);
+    printf("Positions/second: %llu\n", (unsigned long long) (num_positions / seconds));
+    printf("MB/second       : %.1f\n", file.size / seconds / 1e6);
+    printf("Checksum        : %016llx\n", (unsigned long long) checksum);
+
+    unmap_file(&file);
+}
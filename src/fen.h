@@ -0,0 +1,48 @@
+#ifndef FEN_H
+#define FEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "position.h"
+
+enum Fen_error {
+    FEN_OK,
+    FEN_BAD_BOARD,    //Piece placement is malformed
+    FEN_BAD_KINGS,    //Not exactly one king per side
+    FEN_BAD_PAWNS,    //Pawns on the first or last rank
+    FEN_BAD_SIDE,
+    FEN_BAD_CASTLING, //Malformed, or the king or rook isn't on its initial square
+    FEN_BAD_EP,
+    FEN_BAD_CLOCK,
+    FEN_IN_CHECK      //The side not to move is in check
+};
+
+const char *fen_error_str(enum Fen_error err);
+
+/*
+    Parses a FEN, or the four fields of an EPD, starting at str and reading no further than end.
+    The input doesn't need to be NUL-terminated, so positions are read directly from a file
+    mapping without copying. The halfmove clock and fullmove number are optional.
+    On success, *next (if not NULL) points to the first character after the parsed fields.
+    Validity checks that need the attack tables require init_LUTs to have been called.
+*/
+enum Fen_error fen_parse(const char *str, const char *end, struct Position *pos, const char **next);
+
+//A file mapped read-only into memory.
+struct Mapped_file {
+    const char *data;
+    size_t size;
+};
+
+bool map_file(const char *path, struct Mapped_file *file);
+void unmap_file(struct Mapped_file *file);
+
+//Returns the next line of the buffer in [*line, *line + *len) without its line terminator,
+//advancing *cursor. Returns false at the end of the buffer.
+bool next_line(const char **cursor, const char *end, const char **line, size_t *len);
+
+//Parses every line of a FEN or EPD file and prints the parse throughput.
+void fen_bench(const char *path);
+
+#endif
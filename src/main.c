@@ -5,6 +5,10 @@
 
 #include <cargs.h>
 
+#include "batch.h"
+#include "bench.h"
+#include "datagen.h"
+#include "fen.h"
 #include "tests.h"
 #include "tables.h"
 #include "uci.h"
@@ -23,6 +27,83 @@ static struct cag_option options[] = {
      .access_name = "uci",
      .value_name = NULL,
      .description = "Run in UCI mode"
+    },
+    {
+     .identifier = 'b',
+     .access_letters = "b",
+     .access_name = "bench",
+     .value_name = NULL,
+     .description = "Search a fixed set of positions and print the node count and NPS"
+    },
+    {
+     .identifier = 'd',
+     .access_letters = "d",
+     .access_name = "depth",
+     .value_name = "DEPTH",
+     .description = "Search depth used by bench and analyze"
+    },
+    {
+     .identifier = 't',
+     .access_letters = "t",
+     .access_name = "threads",
+     .value_name = "THREADS",
+     .description = "Number of threads used by bench, analyze and datagen"
+    },
+    {
+     .identifier = 'H',
+     .access_letters = "H",
+     .access_name = "hash",
+     .value_name = "MB",
+     .description = "Transposition table size per thread used by bench (default 16)"
+    },
+    {
+     .identifier = 'a',
+     .access_letters = "a",
+     .access_name = "analyze",
+     .value_name = "FILE",
+     .description = "Analyze every position of an EPD file, writing one EPD line with the results per position"
+    },
+    {
+     .identifier = 'o',
+     .access_letters = "o",
+     .access_name = "output",
+     .value_name = "FILE",
+     .description = "Output file used by analyze (default: stdout)"
+    },
+    {
+     .identifier = 'n',
+     .access_letters = "n",
+     .access_name = "nodes",
+     .value_name = "NODES",
+     .description = "Node limit per position used by analyze and datagen"
+    },
+    {
+     .identifier = 'm',
+     .access_letters = "m",
+     .access_name = "movetime",
+     .value_name = "MS",
+     .description = "Time limit per position in milliseconds used by analyze"
+    },
+    {
+     .identifier = 'f',
+     .access_letters = "f",
+     .access_name = "fen-bench",
+     .value_name = "FILE",
+     .description = "Parse every position of a FEN or EPD file and print the throughput"
+    },
+    {
+     .identifier = 'g',
+     .access_letters = "g",
+     .access_name = "datagen",
+     .value_name = "FILE",
+     .description = "Play fixed-node self-play games and write the quiet positions as training data"
+    },
+    {
+     .identifier = 'G',
+     .access_letters = "G",
+     .access_name = "games",
+     .value_name = "GAMES",
+     .description = "Number of games played by datagen"
     }
 };
 
@@ -30,6 +111,17 @@ struct config_opts {
     bool run_perft;
     int perft_depth;
     bool uci_mode;
+    bool run_bench;
+    int depth;
+    int threads;
+    int hash_mb;
+    const char *analyze_file;
+    const char *output_file;
+    u64 nodes;
+    unsigned long movetime;
+    const char *fen_bench_file;
+    const char *datagen_file;
+    int games;
 };
 
 int main(int argc, char* argv[]) {
@@ -47,6 +139,39 @@ int main(int argc, char* argv[]) {
             case 'u':
                 config.uci_mode = true;
                 break;
+            case 'b':
+                config.run_bench = true;
+                break;
+            case 'd':
+                config.depth = atoi(cag_option_get_value(&ctx));
+                break;
+            case 't':
+                config.threads = atoi(cag_option_get_value(&ctx));
+                break;
+            case 'H':
+                config.hash_mb = atoi(cag_option_get_value(&ctx));
+                break;
+            case 'a':
+                config.analyze_file = cag_option_get_value(&ctx);
+                break;
+            case 'o':
+                config.output_file = cag_option_get_value(&ctx);
+                break;
+            case 'n':
+                config.nodes = strtoull(cag_option_get_value(&ctx), NULL, 10);
+                break;
+            case 'm':
+                config.movetime = strtoul(cag_option_get_value(&ctx), NULL, 10);
+                break;
+            case 'f':
+                config.fen_bench_file = cag_option_get_value(&ctx);
+                break;
+            case 'g':
+                config.datagen_file = cag_option_get_value(&ctx);
+                break;
+            case 'G':
+                config.games = atoi(cag_option_get_value(&ctx));
+                break;
         }
     }
     init_LUTs();
@@ -54,6 +179,21 @@ int main(int argc, char* argv[]) {
     if (config.run_perft) {
         run_perft_tests(config.perft_depth);
     }
+    if (config.run_bench) {
+        bench(config.depth, config.threads, config.hash_mb);
+    }
+    if (config.fen_bench_file) {
+        fen_bench(config.fen_bench_file);
+    }
+    if (config.analyze_file) {
+        struct Search_limits limits = { .depth = config.depth, .movetime = config.movetime, .nodes = config.nodes };
+        if (!batch_analyze(config.analyze_file, config.output_file, limits, config.threads))
+            return EXIT_FAILURE;
+    }
+    if (config.datagen_file) {
+        if (!datagen(config.datagen_file, config.games, config.nodes, config.threads))
+            return EXIT_FAILURE;
+    }
     if (config.uci_mode) {
         uci_loop();
     }
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <stdio.h>
 
 #include "attacks.h"
@@ -7,7 +8,8 @@
 #include "tables.h"
 #include "types.h"
 
-int generate_pawn_moves(struct Move* move_list, struct Position *pos) {
+//Pawn moves to the squares in targets. A capture en passant counts as a move to the captured pawn.
+static int pawn_moves(struct Move* move_list, struct Position *pos, u64 targets, MS_Stack *tmp_stack) {
     int number_of_moves = 0;
 
     enum Side us = pos->side_to_move;
@@ -21,17 +23,17 @@ int generate_pawn_moves(struct Move* move_list, struct Position *pos) {
     u64 pawns = pos->piece_bb[PAWN][us];
     u64 promotion_pawns = pawns & our_rank7bb;
 
-    u64 promotion_targets = shift_bb(promotion_pawns, up) & ~pos_occupancy(pos);
+    u64 promotion_targets = shift_bb(promotion_pawns, up) & ~pos_occupancy(pos) & targets;
 
     u64 non_promotion_pawns = pawns ^ promotion_pawns;
     u64 single_push_targets = shift_bb(non_promotion_pawns, up) & ~pos_occupancy(pos);
-    u64 double_push_targets = shift_bb(single_push_targets & our_rank3bb, up) & ~pos_occupancy(pos);
+    u64 double_push_targets = shift_bb(single_push_targets & our_rank3bb, up) & ~pos_occupancy(pos) & targets;
+    single_push_targets &= targets;
 
-    MS_Stack *tmp_stack = stk_create(16);
     while (promotion_pawns) {
         enum Square from = pop_lsb(&promotion_pawns);
         //Attacked squares
-        u64 attacked_sqs = attack_set.pawn[us][from] & pos->occupied_squares[them];
+        u64 attacked_sqs = attack_set.pawn[us][from] & pos->occupied_squares[them] & targets;
         while (attacked_sqs) {
             enum Square to = pop_lsb(&attacked_sqs);
 
@@ -66,7 +68,7 @@ int generate_pawn_moves(struct Move* move_list, struct Position *pos) {
     //Regular pawn attacks
     while (non_promotion_pawns) {
         enum Square from = pop_lsb(&non_promotion_pawns);
-        u64 attacked_sqs = attack_set.pawn[us][from] & pos->occupied_squares[them];
+        u64 attacked_sqs = attack_set.pawn[us][from] & pos->occupied_squares[them] & targets;
 
         while (attacked_sqs) {
             enum Square to = pop_lsb(&attacked_sqs);
@@ -102,7 +104,7 @@ int generate_pawn_moves(struct Move* move_list, struct Position *pos) {
     }
 
     //Enpassant moves
-    if (pos->ep_square != SQUARE_EMPTY) {
+    if (pos->ep_square != SQUARE_EMPTY && (targets & (set_bit(pos->ep_square) | shift_bb(set_bit(pos->ep_square), down)))) {
         u64 ep_square_bb = set_bit(pos->ep_square);
         u64 ep_attacker_squares = shift_E(shift_bb(ep_square_bb, down)) | shift_W(shift_bb(ep_square_bb, down));
 
@@ -121,20 +123,26 @@ int generate_pawn_moves(struct Move* move_list, struct Position *pos) {
         }
     }
 
-    stk_destroy(tmp_stack);
-
     return number_of_moves;
 }
 
-int generate_moves_pt(enum Piece_type pt, struct Move *move_list, struct Position *pos) {
+int generate_pawn_moves(struct Move *move_list, struct Position *pos) {
+    MS_Stack *tmp_stack = stk_create(16);
+    int num_moves_added = pawn_moves(move_list, pos, ~0ULL, tmp_stack);
+    stk_destroy(tmp_stack);
+    return num_moves_added;
+}
+
+//Moves of the pieces of type pt to the squares in targets, castling excluded.
+static int piece_moves(enum Piece_type pt, struct Move *move_list, struct Position *pos, u64 targets,
+                       MS_Stack *tmp_stack) {
     enum Side us = pos->side_to_move;
     u64 piece_squares = pos->piece_bb[pt][us];
-    MS_Stack *tmp_stack = stk_create(16);
 
     int num_moves_added = 0;
     while (piece_squares) {
         enum Square from = pop_lsb(&piece_squares);
-        u64 attacked_sqs = attacks_from(pt, pos, from) & ~pos->occupied_squares[us];
+        u64 attacked_sqs = attacks_from(pt, pos, from) & ~pos->occupied_squares[us] & targets;
 
         while (attacked_sqs) {
             enum Square to = pop_lsb(&attacked_sqs);
@@ -146,6 +154,15 @@ int generate_moves_pt(enum Piece_type pt, struct Move *move_list, struct Positio
         }
     }
 
+    return num_moves_added;
+}
+
+int generate_moves_pt(enum Piece_type pt, struct Move *move_list, struct Position *pos) {
+    enum Side us = pos->side_to_move;
+    MS_Stack *tmp_stack = stk_create(16);
+    int num_moves_added = piece_moves(pt, move_list, pos, ~0ULL, tmp_stack);
+    move_list += num_moves_added;
+
     //Check for castling
     if (pt == KING) {
         if (can_kingside_castle(us, pos)) {
@@ -175,7 +192,40 @@ int generate_moves_pt(enum Piece_type pt, struct Move *move_list, struct Positio
     return num_moves_added;
 }
 
+/*
+    When in check, only king moves to squares the opponent doesn't attack, captures of the checker and
+    interpositions between the checker and the king can be legal, and against a double check only the
+    king moves. The moves come in the same order as from generate_moves.
+*/
+int generate_evasions(struct Move *move_list, struct Position *pos) {
+    assert(pos->checkers);
+    enum Side us = pos->side_to_move;
+    enum Side them = (us == WHITE) ? BLACK : WHITE;
+    enum Square king_square = lsb(pos->piece_bb[KING][us]);
+    const struct Attack_info *ai = pos_attack_info(pos);
+    MS_Stack *tmp_stack = stk_create(16);
+
+    u64 targets = 0ULL;
+    if (popcount(pos->checkers) == 1)
+        targets = pos->checkers | (*in_between_LUT_ptr)[king_square][lsb(pos->checkers)];
+
+    int num_moves_added = 0;
+    for (int piece_t = KNIGHT; piece_t <= KING; ++piece_t) {
+        u64 piece_targets = (piece_t == KING) ? ~ai->attacked[them] : targets;
+        if (piece_targets)
+            num_moves_added += piece_moves(piece_t, move_list + num_moves_added, pos, piece_targets, tmp_stack);
+    }
+    if (targets)
+        num_moves_added += pawn_moves(move_list + num_moves_added, pos, targets, tmp_stack);
+
+    stk_destroy(tmp_stack);
+    return num_moves_added;
+}
+
 int generate_moves(struct Move *move_list, struct Position *pos) {
+    if (pos->checkers)
+        return generate_evasions(move_list, pos);
+
     int num_moves_added = 0;
     int num_new_moves = 0;
 
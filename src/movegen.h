@@ -7,6 +7,9 @@
 int generate_pawn_moves(struct Move *move_list, struct Position *pos);
 int generate_moves_pt(enum Piece_type pt, struct Move *move_list, struct Position *pos);
 
+//Legal moves of a position where the side to move is in check.
+int generate_evasions(struct Move *move_list, struct Position *pos);
+
 int generate_moves(struct Move *move_list, struct Position *pos);
 
 #endif
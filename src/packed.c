@@ -0,0 +1,156 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitboard.h"
+#include "packed.h"
+#include "zobrist.h"
+
+#define PACKED_MAGIC "CB2PK001"
+#define PACKED_HEADER_SZ 64
+
+_Static_assert(sizeof(struct Packed_position) == 32, "Packed_position must be 32 bytes");
+
+struct Packed_header {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+    u64 count;
+};
+
+bool pack_position(const struct Position *pos, struct Packed_position *packed) {
+    u64 occupancy = pos_occupancy(pos);
+    if (popcount(occupancy) > 32)
+        return false;
+
+    memset(packed, 0, sizeof(struct Packed_position));
+    packed->occupancy = occupancy;
+    for (int i = 0; occupancy; ++i) {
+        enum Square sq = pop_lsb(&occupancy);
+        packed->pieces[i / 2] |= (uint8_t) (pos->piece_list[sq] << (4 * (i % 2)));
+    }
+    packed->flags = (uint8_t) (pos->side_to_move
+                               | pos->can_kingside_castle[WHITE] << 1 | pos->can_queenside_castle[WHITE] << 2
+                               | pos->can_kingside_castle[BLACK] << 3 | pos->can_queenside_castle[BLACK] << 4);
+    packed->ep_square = (uint8_t) pos->ep_square;
+    packed->half_move_clock = (uint8_t) (pos->half_move_clock < 255 ? pos->half_move_clock : 255);
+    packed->fullmove_count = (uint16_t) pos->fullmove_count;
+    return true;
+}
+
+bool unpack_position(const struct Packed_position *packed, struct Position *pos) {
+    memset(pos, 0, sizeof(struct Position));
+    u64 occupancy = packed->occupancy;
+    //More than 32 pieces don't fit in the record.
+    if (popcount(occupancy) > 32)
+        return false;
+    for (int i = 0; occupancy; ++i) {
+        enum Square sq = pop_lsb(&occupancy);
+        enum Piece piece = (packed->pieces[i / 2] >> (4 * (i % 2))) & 0xF;
+        if (piece == PIECE_EMPTY || piece > BLACK_KING)
+            return false;
+        pos->piece_list[sq] = piece;
+        pos->piece_bb[to_piece_type(piece)][piece_color(piece)] |= set_bit(sq);
+        pos->occupied_squares[piece_color(piece)] |= set_bit(sq);
+    }
+    pos->side_to_move = (enum Side) (packed->flags & 1);
+    pos->can_kingside_castle[WHITE] = packed->flags >> 1 & 1;
+    pos->can_queenside_castle[WHITE] = packed->flags >> 2 & 1;
+    pos->can_kingside_castle[BLACK] = packed->flags >> 3 & 1;
+    pos->can_queenside_castle[BLACK] = packed->flags >> 4 & 1;
+    pos->ep_square = (enum Square) packed->ep_square;
+    pos->half_move_clock = packed->half_move_clock;
+    pos->fullmove_count = packed->fullmove_count;
+    if (popcount(pos->piece_bb[KING][WHITE]) != 1 || popcount(pos->piece_bb[KING][BLACK]) != 1)
+        return false;
+    //The en passant square is behind a pawn the opponent just pushed two squares.
+    if (pos->ep_square != SQUARE_EMPTY
+        && (pos->ep_square > h8 || sq_rank(pos->ep_square) != (pos->side_to_move == WHITE ? RANK_6 : RANK_3)))
+        return false;
+    pos->key = compute_key(pos);
+    pos->checkers = compute_checkers(pos);
+    return true;
+}
+
+static bool write_header(FILE *f, u64 count) {
+    unsigned char header_buff[PACKED_HEADER_SZ] = {0};
+    struct Packed_header header = {0};
+    memcpy(header.magic, PACKED_MAGIC, 8);
+    header.record_size = sizeof(struct Packed_position);
+    header.count = count;
+    memcpy(header_buff, &header, sizeof(header));
+    return fwrite(header_buff, 1, PACKED_HEADER_SZ, f) == PACKED_HEADER_SZ;
+}
+
+bool packed_writer_open(struct Packed_writer *writer, const char *path) {
+    writer->count = 0;
+    writer->error = false;
+    writer->f = fopen(path, "wb");
+    if (writer->f == NULL)
+        return false;
+    //The count is filled in when the file is closed.
+    if (!write_header(writer->f, 0)) {
+        fclose(writer->f);
+        return false;
+    }
+    return true;
+}
+
+bool packed_writer_write(struct Packed_writer *writer, const struct Packed_position *records, size_t num_records) {
+    if (fwrite(records, sizeof(struct Packed_position), num_records, writer->f) != num_records) {
+        writer->error = true;
+        return false;
+    }
+    writer->count += num_records;
+    return true;
+}
+
+bool packed_writer_close(struct Packed_writer *writer) {
+    bool ok = !writer->error && fseek(writer->f, 0, SEEK_SET) == 0 && write_header(writer->f, writer->count);
+    ok = fclose(writer->f) == 0 && ok;
+    writer->f = NULL;
+    return ok;
+}
+
+bool packed_file_open(struct Packed_file *file, const char *path) {
+    memset(file, 0, sizeof(struct Packed_file));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64) st.st_size < PACKED_HEADER_SZ) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const struct Packed_header *header = map;
+    if (memcmp(header->magic, PACKED_MAGIC, 8) != 0 || header->record_size != sizeof(struct Packed_position)
+        || header->count > ((u64) st.st_size - PACKED_HEADER_SZ) / sizeof(struct Packed_position)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    //Datasets are usually sampled at random.
+    posix_madvise(map, st.st_size, POSIX_MADV_RANDOM);
+    file->records = (const struct Packed_position*) ((const unsigned char*) map + PACKED_HEADER_SZ);
+    file->count = header->count;
+    file->map = map;
+    file->map_size = st.st_size;
+    return true;
+}
+
+void packed_file_close(struct Packed_file *file) {
+    if (file->map != NULL)
+        munmap((void*) file->map, file->map_size);
+    memset(file, 0, sizeof(struct Packed_file));
+}
@@ -0,0 +1,65 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "position.h"
+
+//Game results, from the point of view of white.
+enum Packed_result { PACKED_LOSS, PACKED_DRAW, PACKED_WIN };
+
+/*
+    A position in 32 bytes, for datasets of positions. The pieces are stored in the order of the
+    squares of the occupancy bitboard, 4 bits per piece (an enum Piece), the first piece in the
+    low nibble of pieces[0]. A legal position has at most 32 pieces, so they always fit.
+    score and result are training labels, they are set by the tools that produce datasets
+    and are not part of the position.
+*/
+struct Packed_position {
+    u64 occupancy;
+    uint8_t pieces[16];
+    uint16_t fullmove_count;
+    int16_t score;           //Search score in centipawns, from the point of view of white
+    uint8_t flags;           //Bit 0: side to move, bits 1-4: castling rights (K, Q, k, q)
+    uint8_t ep_square;       //SQUARE_EMPTY if there is none
+    uint8_t half_move_clock; //Capped at 255
+    uint8_t result;          //enum Packed_result
+};
+
+//Returns false if the position has more than 32 pieces. The labels are set to 0.
+bool pack_position(const struct Position *pos, struct Packed_position *packed);
+//Returns false if the record is corrupt: an invalid piece code, not exactly one king per side or an
+//impossible en passant square.
+bool unpack_position(const struct Packed_position *packed, struct Position *pos);
+
+/*
+    Files of packed positions: a 64-byte header with the record count, followed by the records in
+    native byte order. Records are written sequentially with a Packed_writer and read by mapping the
+    whole file, which gives random access to any record.
+*/
+struct Packed_writer {
+    FILE *f;
+    u64 count;
+    bool error;
+};
+
+bool packed_writer_open(struct Packed_writer *writer, const char *path);
+bool packed_writer_write(struct Packed_writer *writer, const struct Packed_position *records, size_t num_records);
+//Writes the record count to the header and closes the file. Returns false if any write failed.
+bool packed_writer_close(struct Packed_writer *writer);
+
+struct Packed_file {
+    const struct Packed_position *records;
+    u64 count;
+    const void *map;
+    size_t map_size;
+};
+
+//Maps a file of packed positions. Returns false if it can't be opened or isn't a valid file.
+bool packed_file_open(struct Packed_file *file, const char *path);
+void packed_file_close(struct Packed_file *file);
+
+#endif
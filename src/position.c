@@ -7,8 +7,13 @@
 
 #include "attacks.h"
 #include "bitboard.h"
+#include "movegen.h"
 #include "position.h"
+#include "tables.h"
 #include "types.h"
+#include "zobrist.h"
+
+#define MAX_NUM_MOVES 256
 
 //LUT used to get square name from square index. The square index is ordered according
 //to the Square enum.
@@ -143,36 +148,43 @@ static struct Move reverse(struct Move move) {
 */
 bool legal(struct Move m, struct Position *pos, MS_Stack *move_state_stk) {
     enum Side us = pos->side_to_move;
-    enum Square original_king_square = lsb(pos->piece_bb[KING][us]);
-    //Is the king attacked after the move?
-    make_move(m, pos, move_state_stk);
+    enum Side them = other_side(us);
     enum Square king_square = lsb(pos->piece_bb[KING][us]);
-    u64 king_attackers = attackers_to(king_square, pos, us);
-    unmake_move(m, pos, move_state_stk);
-    if (king_attackers != 0ULL)
-        return false;
-
-    //Only other possibility for a move to not be legal, is if the move is castling, and the king passes through check when castling.
-    //We already checked if the king's destination square is attacked, so is sufficient to check the passed through square.
-    //It is also not permitted to castle when the king is in check.
-    if (m.castling) {
-        if (attackers_to(original_king_square, pos, us) != 0ULL)
-            return false;
-        //Kingside castling
-        if (set_bit(m.to_sq) & FileGBB) {
-            enum Square passed_square = (us == WHITE) ? f1 : f8;
-            if (attackers_to(passed_square, pos, us) != 0ULL)
-                return false;
-        }
-        //Queenside castling
-        else if (set_bit(m.to_sq) & FileCBB) {
-            enum Square passed_square_d = (us == WHITE) ? d1 : d8;
-            if (attackers_to(passed_square_d, pos, us) != 0ULL)
+    const struct Attack_info *ai = pos_attack_info(pos);
+
+    //The king may not move to an attacked square. When castling, it is also not permitted to
+    //castle out of check or to pass through an attacked square.
+    if (m.from_sq == king_square) {
+        if (m.castling) {
+            enum Square passed_square = (set_bit(m.to_sq) & FileGBB) ? m.from_sq + 1 : m.from_sq - 1;
+            if (pos->checkers || is_set(passed_square, ai->attacked[them]))
                 return false;
         }
+        return !is_set(m.to_sq, ai->attacked[them]);
+    }
+
+    //En passant removes two pieces from the rank of the king, which can uncover an attack that
+    //the pins don't show. It is rare enough to check by making the move.
+    if (m.en_passant) {
+        make_move(m, pos, move_state_stk);
+        u64 king_attackers = attackers_to(king_square, pos, us);
+        unmake_move(m, pos, move_state_stk);
+        return king_attackers == 0ULL;
     }
 
-    return true;
+    //In check, another piece can only capture a single checker or block the check.
+    if (pos->checkers) {
+        if (popcount(pos->checkers) > 1)
+            return false;
+        u64 targets = pos->checkers | (*in_between_LUT_ptr)[king_square][lsb(pos->checkers)];
+        if (!is_set(m.to_sq, targets))
+            return false;
+    }
+
+    //A pinned piece may only move along the line between the king and the pinner.
+    return !is_set(m.from_sq, ai->pinned)
+           || is_set(m.from_sq, (*in_between_LUT_ptr)[king_square][m.to_sq])
+           || is_set(m.to_sq, (*in_between_LUT_ptr)[king_square][m.from_sq]);
 }
 
 static void store_move_state(const struct Position *pos, struct Move m, MS_Stack *move_state_stack) {
@@ -185,6 +197,9 @@ static void store_move_state(const struct Position *pos, struct Move m, MS_Stack
     ms.can_queenside_castle[BLACK] = pos->can_queenside_castle[BLACK];
     ms.captured_piece = pos->piece_list[m.to_sq];
     ms.ep_square = pos->ep_square;
+    ms.key = pos->key;
+    ms.checkers = pos->checkers;
+    ms.attack_info = pos->attack_info;
     stk_push(move_state_stack, ms);
 }
 
@@ -194,6 +209,7 @@ static void clear_square(enum Square sq, struct Position *pos) {
     enum Side us = piece_color(cleared_piece);
     enum Piece_type cleared_piece_type = to_piece_type(cleared_piece);
     pos->piece_list[sq] = PIECE_EMPTY;
+    pos->key ^= zobrist_piece(cleared_piece, sq);
     pos->piece_bb[cleared_piece_type][us] ^= set_bit(sq);
     pos->occupied_squares[us] ^= set_bit(sq);
 }
@@ -203,6 +219,9 @@ static void place_piece(enum Square sq, enum Piece piece, struct Position *pos)
     enum Side us = piece_color(piece);
     enum Side them = abs(us - 1);
     u64 sq_bb = set_bit(sq);
+    if (pos->piece_list[sq] != PIECE_EMPTY)
+        pos->key ^= zobrist_piece(pos->piece_list[sq], sq);
+    pos->key ^= zobrist_piece(piece, sq);
     pos->piece_list[sq] = piece;
     pos->piece_bb[piece_type][us] |= sq_bb;
 
@@ -222,6 +241,45 @@ static void move_piece(struct Move m, struct Position *pos) {
     place_piece(m.to_sq, moved_piece, pos);
 }
 
+/*
+    Pieces of the side that just moved that give check after m: the moved piece itself (or the rook
+    when castling), and sliders whose line to the king went through a square the move vacated.
+    The position must not have had the side to move in check before the move.
+*/
+static u64 move_checkers(struct Move m, const struct Position *pos) {
+    enum Side them = pos->side_to_move;
+    enum Side us = other_side(them);
+    enum Square king_square = lsb(pos->piece_bb[KING][them]);
+    u64 king_bb = set_bit(king_square);
+
+    u64 checkers = 0ULL;
+    enum Square checking_sq = m.to_sq;
+    enum Piece_type pt = to_piece_type(pos->piece_list[m.to_sq]);
+    if (m.castling) {
+        checking_sq = (set_bit(m.to_sq) & FileGBB) ? m.to_sq - 1 : m.to_sq + 1;
+        pt = ROOK;
+    }
+    if (pt == PAWN)
+        checkers |= attack_set.pawn[them][king_square] & set_bit(checking_sq);
+    else if (attacks_from(pt, pos, checking_sq) & king_bb)
+        checkers |= set_bit(checking_sq);
+
+    //The squares a move vacates: the from square, the captured pawn in en passant and the rook in castling.
+    u64 vacated = set_bit(m.from_sq);
+    if (m.en_passant)
+        vacated |= set_bit((us == WHITE) ? m.to_sq - 8 : m.to_sq + 8);
+    else if (m.castling)
+        vacated |= set_bit((set_bit(m.to_sq) & FileGBB) ? m.to_sq + 1 : m.to_sq - 2);
+
+    const u64 *rays = (*attack_rays_ptr)[king_square];
+    u64 queens = pos->piece_bb[QUEEN][us];
+    if (vacated & (rays[NORTH] | rays[EAST] | rays[SOUTH] | rays[WEST]))
+        checkers |= attacks_from(ROOK, pos, king_square) & (pos->piece_bb[ROOK][us] | queens);
+    if (vacated & (rays[NORTHEAST] | rays[NORTHWEST] | rays[SOUTHEAST] | rays[SOUTHWEST]))
+        checkers |= attacks_from(BISHOP, pos, king_square) & (pos->piece_bb[BISHOP][us] | queens);
+    return checkers;
+}
+
 void make_move(struct Move m, struct Position *pos, MS_Stack *move_state_stk) {
     assert(piece_color(pos->piece_list[m.from_sq]) == pos->side_to_move);
     enum Piece moved_piece = pos->piece_list[m.from_sq];
@@ -230,6 +288,9 @@ void make_move(struct Move m, struct Position *pos, MS_Stack *move_state_stk) {
 
     if (move_state_stk != NULL)
         store_move_state(pos, m, move_state_stk);
+    //The castling, en passant and side to move part of the key is replaced once the move is made.
+    pos->key ^= zobrist_state_key(pos);
+    pos->attack_info.valid = false;
 
     //If the king moves, the right to castle is lost.
     if (moved_piece_type == KING) {
@@ -303,6 +364,8 @@ void make_move(struct Move m, struct Position *pos, MS_Stack *move_state_stk) {
 
     if (us == BLACK)
         ++pos->fullmove_count;
+    pos->key ^= zobrist_state_key(pos);
+    pos->checkers = move_checkers(m, pos);
 }
 
 void unmake_move(struct Move m, struct Position *pos, MS_Stack *move_state_stk) {
@@ -354,6 +417,9 @@ void unmake_move(struct Move m, struct Position *pos, MS_Stack *move_state_stk)
     pos->can_kingside_castle[BLACK] = prev_move_state.can_kingside_castle[BLACK];
     pos->can_queenside_castle[BLACK] = prev_move_state.can_queenside_castle[BLACK];
     pos->side_to_move = other_side(pos->side_to_move);
+    pos->key = prev_move_state.key;
+    pos->checkers = prev_move_state.checkers;
+    pos->attack_info = prev_move_state.attack_info;
 }
 
 void init_pos_struct(struct Position *pos) {
@@ -366,6 +432,7 @@ void init_pos_struct(struct Position *pos) {
     pos->occupied_squares[BLACK] = 0ULL;
 
     pos->empty_squares = 0ULL;
+    pos->attack_info.valid = false;
 }
 
 void pos_from_piece_list(struct Position *pos) {
@@ -377,6 +444,7 @@ void pos_from_piece_list(struct Position *pos) {
             pos->occupied_squares[color] |= set_bit(i);
         }
     }
+    pos->attack_info.valid = false;
 }
 
 /*
@@ -482,15 +550,24 @@ struct Position pos_from_FEN(const char *fen_str) {
     assert(isdigit(fen_str[str_idx]) && (isdigit(fen_str[str_idx + 1]) || isspace(fen_str[str_idx + 1])));
 
     //one digit number
-    if (isspace(fen_str[str_idx + 1]))
+    if (isspace(fen_str[str_idx + 1])) {
         pos.half_move_clock = fen_str[str_idx] - '0';
-    else { //Two digit number
+        str_idx += 1;
+    } else { //Two digit number
         char tmp[3];
         strncpy(tmp, fen_str + str_idx, 2);
         tmp[2] = '\0';
         pos.half_move_clock = atoi(tmp);
+        str_idx += 2;
     }
 
+    //The fullmove counter is optional in some FEN strings (e.g. EPD), it defaults to 1 then.
+    pos.fullmove_count = 1;
+    if (isspace(fen_str[str_idx]) && isdigit(fen_str[str_idx + 1]))
+        pos.fullmove_count = atoi(fen_str + str_idx + 1);
+
+    pos.key = compute_key(&pos);
+    pos.checkers = compute_checkers(&pos);
     return pos;
 }
 
@@ -570,6 +647,114 @@ void print_move(struct Move move, const struct Position *pos) {
     printf("\n");
 }
 
+void move_to_str(struct Move move, char *str) {
+    static const char promotion_chars[] = "pnbrqk";
+    str[0] = square_name_LUT[move.from_sq][0];
+    str[1] = square_name_LUT[move.from_sq][1];
+    str[2] = square_name_LUT[move.to_sq][0];
+    str[3] = square_name_LUT[move.to_sq][1];
+
+    if (move.promotion_type != PT_NULL) {
+        str[4] = promotion_chars[move.promotion_type];
+        str[5] = '\0';
+    } else {
+        str[4] = '\0';
+    }
+}
+
+void pos_to_FEN(const struct Position *pos, char *str) {
+    static const char piece_chars[] = " PNBRQKpnbrqk";
+    int idx = 0;
+    for (int rank = RANK_8; rank >= RANK_1; --rank) {
+        int empty = 0;
+        for (int file = FILE_A; file <= FILE_H; ++file) {
+            enum Piece piece = pos->piece_list[file_rank_sq((enum File) file, (enum Rank) rank)];
+            if (piece == PIECE_EMPTY) {
+                ++empty;
+                continue;
+            }
+            if (empty)
+                str[idx++] = (char) ('0' + empty);
+            empty = 0;
+            str[idx++] = piece_chars[piece];
+        }
+        if (empty)
+            str[idx++] = (char) ('0' + empty);
+        if (rank != RANK_1)
+            str[idx++] = '/';
+    }
+
+    str[idx++] = ' ';
+    str[idx++] = (pos->side_to_move == WHITE) ? 'w' : 'b';
+    str[idx++] = ' ';
+    int castling_start = idx;
+    if (pos->can_kingside_castle[WHITE]) str[idx++] = 'K';
+    if (pos->can_queenside_castle[WHITE]) str[idx++] = 'Q';
+    if (pos->can_kingside_castle[BLACK]) str[idx++] = 'k';
+    if (pos->can_queenside_castle[BLACK]) str[idx++] = 'q';
+    if (idx == castling_start)
+        str[idx++] = '-';
+
+    sprintf(&str[idx], " %s %u %u", pos->ep_square == SQUARE_EMPTY ? "-" : square_name_LUT[pos->ep_square],
+            pos->half_move_clock, pos->fullmove_count);
+}
+
+void move_to_san(struct Move move, struct Position *pos, char *str) {
+    static const char piece_chars[] = "PNBRQK";
+    enum Piece_type pt = to_piece_type(pos->piece_list[move.from_sq]);
+    bool capture = pos->piece_list[move.to_sq] != PIECE_EMPTY || move.en_passant;
+    int idx = 0;
+
+    if (move.castling) {
+        idx += sprintf(str, sq_file(move.to_sq) == FILE_G ? "O-O" : "O-O-O");
+    } else {
+        struct Move move_list[MAX_NUM_MOVES];
+        int num_moves = generate_moves(move_list, pos);
+
+        if (pt != PAWN) {
+            str[idx++] = piece_chars[pt];
+            //Disambiguate between pieces of the same type that can move to the same square.
+            bool ambiguous = false, same_file = false, same_rank = false;
+            for (int i = 0; i < num_moves; ++i) {
+                enum Square from = move_list[i].from_sq;
+                if (move_list[i].to_sq != move.to_sq || from == move.from_sq
+                    || to_piece_type(pos->piece_list[from]) != pt)
+                    continue;
+                ambiguous = true;
+                same_file |= sq_file(from) == sq_file(move.from_sq);
+                same_rank |= sq_rank(from) == sq_rank(move.from_sq);
+            }
+            if (ambiguous && (!same_file || same_rank))
+                str[idx++] = square_name_LUT[move.from_sq][0];
+            if (ambiguous && same_file)
+                str[idx++] = square_name_LUT[move.from_sq][1];
+        } else if (capture) {
+            str[idx++] = square_name_LUT[move.from_sq][0];
+        }
+
+        if (capture)
+            str[idx++] = 'x';
+        str[idx++] = square_name_LUT[move.to_sq][0];
+        str[idx++] = square_name_LUT[move.to_sq][1];
+        if (move.promotion_type != PT_NULL) {
+            str[idx++] = '=';
+            str[idx++] = piece_chars[move.promotion_type];
+        }
+    }
+
+    //Check or checkmate
+    MS_Stack *move_stack = stk_create(2);
+    make_move(move, pos, move_stack);
+    if (pos->checkers) {
+        struct Move replies[MAX_NUM_MOVES];
+        str[idx++] = generate_moves(replies, pos) ? '+' : '#';
+    }
+    unmake_move(move, pos, move_stack);
+    stk_destroy(move_stack);
+
+    str[idx] = '\0';
+}
+
 static bool queenside_castling_impeded(enum Side side, const struct Position *pos) {
     return (side == WHITE) ? pos_occupancy(pos) & (set_bit(b1) | set_bit(c1) | set_bit(d1)) :
                              pos_occupancy(pos) & (set_bit(b8) | set_bit(c8) | set_bit(d8));
@@ -597,3 +782,108 @@ bool can_queenside_castle(enum Side side, const struct Position *pos) {
            && (pos->piece_bb[KING][side] & king_square)
            && !queenside_castling_impeded(side, pos);
 }
+
+u64 compute_checkers(const struct Position *pos) {
+    enum Side us = pos->side_to_move;
+    return attackers_to(lsb(pos->piece_bb[KING][us]), pos, us);
+}
+
+static u64 attacked_squares(enum Side side, const struct Position *pos, u64 occupancy) {
+    u64 empty = ~occupancy;
+    u64 pawns = pos->piece_bb[PAWN][side];
+    u64 attacked = (side == WHITE) ? shift_NE(pawns) | shift_NW(pawns) : shift_SE(pawns) | shift_SW(pawns);
+    for (u64 knights = pos->piece_bb[KNIGHT][side]; knights;)
+        attacked |= attack_set.knight[pop_lsb(&knights)];
+    attacked |= attack_set.king[lsb(pos->piece_bb[KING][side])];
+    attacked |= bishop_attacks_setwise(pos->piece_bb[BISHOP][side] | pos->piece_bb[QUEEN][side], empty);
+    attacked |= rook_attacks_setwise(pos->piece_bb[ROOK][side] | pos->piece_bb[QUEEN][side], empty);
+    return attacked;
+}
+
+//Pieces of blocker_side that stand alone between the king of side and a slider of the other side.
+static u64 slider_blockers(enum Side side, enum Side blocker_side, const struct Position *pos) {
+    enum Side them = other_side(side);
+    enum Square king_square = lsb(pos->piece_bb[KING][side]);
+    const u64 *rays = (*attack_rays_ptr)[king_square];
+    u64 queens = pos->piece_bb[QUEEN][them];
+    u64 snipers = ((rays[NORTH] | rays[EAST] | rays[SOUTH] | rays[WEST]) & (pos->piece_bb[ROOK][them] | queens))
+                | ((rays[NORTHEAST] | rays[NORTHWEST] | rays[SOUTHEAST] | rays[SOUTHWEST])
+                   & (pos->piece_bb[BISHOP][them] | queens));
+
+    u64 occupancy = pos_occupancy(pos);
+    u64 single_blockers = 0ULL;
+    while (snipers) {
+        u64 blockers = (*in_between_LUT_ptr)[king_square][pop_lsb(&snipers)] & occupancy;
+        if (popcount(blockers) == 1)
+            single_blockers |= blockers;
+    }
+    return single_blockers & pos->occupied_squares[blocker_side];
+}
+
+const struct Attack_info *pos_attack_info(struct Position *pos) {
+    struct Attack_info *ai = &pos->attack_info;
+    if (ai->valid)
+        return ai;
+
+    enum Side us = pos->side_to_move;
+    enum Side them = other_side(us);
+    enum Square king_square = lsb(pos->piece_bb[KING][us]);
+    u64 occupancy = pos_occupancy(pos);
+    ai->attacked[us] = attacked_squares(us, pos, occupancy);
+    ai->attacked[them] = attacked_squares(them, pos, occupancy ^ set_bit(king_square));
+    ai->pinned = slider_blockers(us, us, pos);
+    ai->discoverers = slider_blockers(them, us, pos);
+
+    enum Square their_king_square = lsb(pos->piece_bb[KING][them]);
+    ai->check_squares[PAWN] = attack_set.pawn[them][their_king_square];
+    ai->check_squares[KNIGHT] = attack_set.knight[their_king_square];
+    ai->check_squares[BISHOP] = slider_attacks(BISHOP, occupancy, their_king_square);
+    ai->check_squares[ROOK] = slider_attacks(ROOK, occupancy, their_king_square);
+    ai->check_squares[QUEEN] = ai->check_squares[BISHOP] | ai->check_squares[ROOK];
+    ai->check_squares[KING] = 0ULL;
+    ai->valid = true;
+    return ai;
+}
+
+bool gives_check(struct Move m, struct Position *pos) {
+    enum Side us = pos->side_to_move;
+    enum Square king_square = lsb(pos->piece_bb[KING][other_side(us)]);
+    const struct Attack_info *ai = pos_attack_info(pos);
+    enum Piece_type pt = to_piece_type(pos->piece_list[m.from_sq]);
+
+    //Direct check. A promoted piece may check through the square the pawn left.
+    if (m.promotion_type != PT_NULL) {
+        u64 occupancy = pos_occupancy(pos) ^ set_bit(m.from_sq);
+        if (m.promotion_type == KNIGHT ? is_set(m.to_sq, ai->check_squares[KNIGHT])
+                                       : is_set(king_square, slider_attacks(m.promotion_type, occupancy, m.to_sq)))
+            return true;
+    } else if (is_set(m.to_sq, ai->check_squares[pt])) {
+        return true;
+    }
+
+    //Discovered check, unless the piece stays on the line to the king.
+    if (is_set(m.from_sq, ai->discoverers)
+        && !is_set(m.from_sq, (*in_between_LUT_ptr)[king_square][m.to_sq])
+        && !is_set(m.to_sq, (*in_between_LUT_ptr)[king_square][m.from_sq]))
+        return true;
+
+    //The rook checks after castling.
+    if (m.castling) {
+        bool kingside = set_bit(m.to_sq) & FileGBB;
+        enum Square rook_from = kingside ? m.to_sq + 1 : m.to_sq - 2;
+        enum Square rook_to = kingside ? m.to_sq - 1 : m.to_sq + 1;
+        u64 occupancy = pos_occupancy(pos) ^ set_bit(m.from_sq) ^ set_bit(rook_from)
+                        ^ set_bit(m.to_sq) ^ set_bit(rook_to);
+        return is_set(king_square, slider_attacks(ROOK, occupancy, rook_to));
+    }
+
+    //En passant also removes the captured pawn, which can uncover a check from one of our sliders.
+    if (m.en_passant) {
+        enum Square captured_sq = (us == WHITE) ? m.to_sq - 8 : m.to_sq + 8;
+        u64 occupancy = pos_occupancy(pos) ^ set_bit(m.from_sq) ^ set_bit(captured_sq) ^ set_bit(m.to_sq);
+        u64 queens = pos->piece_bb[QUEEN][us];
+        return (slider_attacks(ROOK, occupancy, king_square) & (pos->piece_bb[ROOK][us] | queens))
+               || (slider_attacks(BISHOP, occupancy, king_square) & (pos->piece_bb[BISHOP][us] | queens));
+    }
+    return false;
+}
@@ -7,6 +7,24 @@
 #include "types.h"
 
 #define INIT_STACK_SIZE 256
+#define FEN_MAX_LEN 100
+
+/*
+    Attack information of a position, computed on first use by pos_attack_info so that movegen,
+    legality checks and evaluation share a single computation per node.
+*/
+struct Attack_info {
+    //Squares attacked by each side. The attacks of the side not to move are computed as if the king
+    //of the side to move was not on the board, so that the king can't retreat along a checking line.
+    u64 attacked[2];
+    //Pieces of the side to move that are pinned to their king.
+    u64 pinned;
+    //Pieces of the side to move that would give a discovered check by moving off the line to the other king.
+    u64 discoverers;
+    //Squares from which a piece of each type of the side to move would check the other king.
+    u64 check_squares[6];
+    bool valid;
+};
 
 struct Position {
     //Bitboards for the pieces indexed by piece_type and side.
@@ -29,6 +47,15 @@ struct Position {
 
     unsigned int half_move_clock;
     unsigned int fullmove_count;
+
+    //Zobrist key, updated incrementally by make_move and unmake_move.
+    u64 key;
+
+    //Pieces giving check to the king of the side to move, updated by make_move and unmake_move.
+    u64 checkers;
+
+    //Invalidated by make_move and restored by unmake_move.
+    struct Attack_info attack_info;
 };
 
 struct Move {
@@ -48,6 +75,9 @@ struct Move_state {
     bool can_kingside_castle[2];
     bool can_queenside_castle[2];
     enum Piece captured_piece;
+    u64 key;
+    u64 checkers;
+    struct Attack_info attack_info;
 };
 
 void make_move(struct Move m, struct Position *pos, MS_Stack *move_state_stk);
@@ -61,12 +91,36 @@ bool legal(struct Move m, struct Position *pos, MS_Stack *move_state_stk);
 //Prints a move in the given notation in algebraic notation.
 void print_move(struct Move move, const struct Position *pos);
 
+//Writes the move in UCI long algebraic notation (e.g. e2e4, e7e8q) to str, which must hold at least 6 chars.
+void move_to_str(struct Move move, char *str);
+
+//Writes the move in standard algebraic notation (e.g. Nbd7, exd5, O-O, e8=Q#) to str,
+//which must hold at least 8 chars. The move must be legal.
+void move_to_san(struct Move move, struct Position *pos, char *str);
+
+//Writes the FEN of the position to str, which must hold at least FEN_MAX_LEN + 1 chars.
+void pos_to_FEN(const struct Position *pos, char *str);
+
 //Prints a simple ASCII representation of the position.
 void print_position(const struct Position *position);
 
 bool can_kingside_castle(enum Side side, const struct Position *pos);
 bool can_queenside_castle(enum Side side, const struct Position *pos);
 
+//True if the king of the side to move is attacked.
+static inline bool pos_in_check(const struct Position *pos) {
+    return pos->checkers != 0ULL;
+}
+
+//Computes the checkers of a position from scratch, for positions that weren't reached by make_move.
+u64 compute_checkers(const struct Position *pos);
+
+//Returns the attack information of the position, computing it if it isn't cached yet.
+const struct Attack_info *pos_attack_info(struct Position *pos);
+
+//True if the pseudo-legal move m checks the opponent's king. The position is not changed.
+bool gives_check(struct Move m, struct Position *pos);
+
 static inline enum Piece get_piece(struct Position p, enum Square s) {
     return p.piece_list[s];
 }
@@ -1,58 +1,554 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "search.h"
+#include "bitbase.h"
+#include "bitboard.h"
 #include "position.h"
 #include "evaluation.h"
 #include "movegen.h"
+#include "tablebase.h"
 
 #define MAX_NUM_MOVES 256
 
+//The clock is only read once every CHECK_INTERVAL nodes, so that time keeping and
+//the periodic UCI output never show up when profiling the search.
+#define CHECK_INTERVAL 2048
+#define HEARTBEAT_INTERVAL_MS 1000
+#define CURRMOVE_DELAY_MS 1000
+
+#define INFO_BUFF_SZ 1024
+
 int max(int a, int b) {
     return a > b ? a : b;
 };
 
-int negamax_root(struct Position *pos, int depth, struct Move *best_move) {
+static int min(int a, int b) {
+    return a < b ? a : b;
+}
+
+long long get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void search_info_init(struct Search_info *si, struct Search_limits limits) {
+    si->limits = limits;
+    si->silent = false;
+    si->stop = false;
+    si->ponder = false;
+    si->nodes = 0;
+    si->tb_hits = 0;
+    si->seldepth = 0;
+    si->completed_depth = 0;
+    si->start_time = get_time_ms();
+    si->last_output_time = si->start_time;
+    si->move_stack = stk_create(MAX_PLY);
+    si->tt = NULL;
+    si->game_plies = 0;
+    for (int ply = 0; ply < MAX_PLY; ++ply)
+        si->pv_length[ply] = 0;
+    si->root_pv_length = 0;
+    si->root_moves = NULL;
+    si->num_root_moves = 0;
+#ifdef SEARCH_STATS
+    memset(&si->stats, 0, sizeof(si->stats));
+#endif
+}
+
+void search_info_destroy(struct Search_info *si) {
+    stk_destroy(si->move_stack);
+    free(si->root_moves);
+    si->root_moves = NULL;
+}
+
+void search_info_set_history(struct Search_info *si, const u64 *keys, int num_keys) {
+    if (num_keys > MAX_GAME_HISTORY) {
+        keys += num_keys - MAX_GAME_HISTORY;
+        num_keys = MAX_GAME_HISTORY;
+    }
+    memcpy(si->key_history, keys, num_keys * sizeof(u64));
+    si->game_plies = num_keys;
+}
+
+void search_ponderhit(struct Search_info *si) {
+    //A normal search reads its limits while running, so they may only change while pondering.
+    if (!si->ponder)
+        return;
+    //The limits are only read by the search thread once ponder is cleared.
+    if (si->limits.movetime)
+        si->limits.movetime += (unsigned long) (get_time_ms() - si->start_time);
+    si->ponder = false;
+}
+
+#ifdef SEARCH_STATS
+void search_stats_add(struct Search_stats *dst, const struct Search_stats *src) {
+    dst->pv_nodes += src->pv_nodes;
+    dst->cut_nodes += src->cut_nodes;
+    dst->all_nodes += src->all_nodes;
+    dst->leaf_nodes += src->leaf_nodes;
+    dst->beta_cutoffs += src->beta_cutoffs;
+    dst->first_move_cutoffs += src->first_move_cutoffs;
+    dst->tt_probes += src->tt_probes;
+    dst->tt_hits += src->tt_hits;
+    dst->tt_cutoffs += src->tt_cutoffs;
+}
+
+static double percentage(u64 part, u64 total) {
+    return total ? 100.0 * (double) part / (double) total : 0.0;
+}
+
+void print_search_stats(const struct Search_stats *stats) {
+    u64 interior_nodes = stats->pv_nodes + stats->cut_nodes + stats->all_nodes;
+    printf("info string interior nodes %llu (pv %.1f%% cut %.1f%% all %.1f%%) leaf nodes %llu\n",
+           (unsigned long long) interior_nodes,
+           percentage(stats->pv_nodes, interior_nodes),
+           percentage(stats->cut_nodes, interior_nodes),
+           percentage(stats->all_nodes, interior_nodes),
+           (unsigned long long) stats->leaf_nodes);
+    printf("info string beta cutoffs %llu, on first move %llu (%.1f%%)\n",
+           (unsigned long long) stats->beta_cutoffs,
+           (unsigned long long) stats->first_move_cutoffs,
+           percentage(stats->first_move_cutoffs, stats->beta_cutoffs));
+    printf("info string tt probes %llu, hits %llu (%.1f%%), cutoffs %llu (%.1f%%)\n",
+           (unsigned long long) stats->tt_probes,
+           (unsigned long long) stats->tt_hits,
+           percentage(stats->tt_hits, stats->tt_probes),
+           (unsigned long long) stats->tt_cutoffs,
+           percentage(stats->tt_cutoffs, stats->tt_probes));
+}
+#endif
+
+static unsigned long long nodes_per_second(u64 nodes, long long elapsed) {
+    return elapsed > 0 ? (unsigned long long) (nodes * 1000 / elapsed) : (unsigned long long) nodes;
+}
+
+//Writes the score in UCI format: "cp <centipawns>", or "mate <moves>" with a negative number of moves
+//if the side to move is getting mated.
+static int score_to_str(int score, char *str, size_t size) {
+    if (abs(score) < MATE_BOUND)
+        return snprintf(str, size, "cp %d", score);
+    int plies = MATE_SCORE - abs(score);
+    return snprintf(str, size, "mate %d", score > 0 ? (plies + 1) / 2 : -plies / 2);
+}
+
+//Prints one line of a completed iteration, as a single write so lines from different threads don't interleave.
+//multipv is 0 when only the best line is reported.
+static void print_pv_line(const struct Search_info *si, int depth, int multipv, int score,
+                          const struct Move *pv, int pv_length) {
+    char buff[INFO_BUFF_SZ];
+    char score_str[24];
+    score_to_str(score, score_str, sizeof(score_str));
+    long long elapsed = get_time_ms() - si->start_time;
+    int idx = snprintf(buff, INFO_BUFF_SZ, "info depth %d seldepth %d", depth, si->seldepth);
+    if (multipv > 0)
+        idx += snprintf(&buff[idx], INFO_BUFF_SZ - idx, " multipv %d", multipv);
+    idx += snprintf(&buff[idx], INFO_BUFF_SZ - idx, " score %s nodes %llu nps %llu tbhits %llu time %lld",
+                    score_str, (unsigned long long) si->nodes, nodes_per_second(si->nodes, elapsed),
+                    (unsigned long long) si->tb_hits, elapsed);
+    if (si->tt != NULL)
+        idx += snprintf(&buff[idx], INFO_BUFF_SZ - idx, " hashfull %d", tt_hashfull(si->tt));
+    idx += snprintf(&buff[idx], INFO_BUFF_SZ - idx, " pv");
+
+    for (int i = 0; i < pv_length && idx < INFO_BUFF_SZ - 8; ++i) {
+        char move_str[6];
+        move_to_str(pv[i], move_str);
+        idx += snprintf(&buff[idx], INFO_BUFF_SZ - idx, " %s", move_str);
+    }
+
+    puts(buff);
+}
+
+//Prints the summary of a completed iteration: the best line, or the MultiPV best lines.
+static void print_iteration_info(const struct Search_info *si, int depth, int score) {
+    if (si->limits.multipv <= 1 || si->num_root_moves == 0) {
+        print_pv_line(si, depth, 0, score, si->pv_table[0], si->pv_length[0]);
+        return;
+    }
+    for (int i = 0; i < si->limits.multipv && i < si->num_root_moves; ++i) {
+        const struct Root_move *rm = &si->root_moves[i];
+        print_pv_line(si, depth, i + 1, rm->score, rm->pv, rm->pv_length);
+    }
+}
+
+static void print_heartbeat(const struct Search_info *si, long long now) {
+    long long elapsed = now - si->start_time;
+    printf("info nodes %llu nps %llu time %lld\n", (unsigned long long) si->nodes,
+           nodes_per_second(si->nodes, elapsed), elapsed);
+}
+
+static void print_currmove(int depth, struct Move move, int move_number) {
+    char move_str[6];
+    move_to_str(move, move_str);
+    printf("info depth %d currmove %s currmovenumber %d\n", depth, move_str, move_number);
+}
+
+//Called every CHECK_INTERVAL nodes. Handles the search limits and the periodic progress output.
+static void check_limits(struct Search_info *si) {
+    long long now = get_time_ms();
+
+    //The first iteration is always completed, so that there is a move to play.
+    if (si->completed_depth > 0 && !si->ponder) {
+        if (si->limits.movetime && now - si->start_time >= (long long) si->limits.movetime)
+            si->stop = true;
+        if (si->limits.nodes && si->nodes >= si->limits.nodes)
+            si->stop = true;
+    }
+
+    if (!si->silent && now - si->last_output_time >= HEARTBEAT_INTERVAL_MS) {
+        print_heartbeat(si, now);
+        si->last_output_time = now;
+    }
+}
+
+static void update_pv(struct Search_info *si, int ply, struct Move move) {
+    si->pv_table[ply][ply] = move;
+    for (int i = ply + 1; i < si->pv_length[ply + 1]; ++i)
+        si->pv_table[ply][i] = si->pv_table[ply + 1][i];
+    si->pv_length[ply] = max(si->pv_length[ply + 1], ply + 1);
+}
+
+/*
+    Draw by the fifty-move rule or by repetition. A position that already occurred on the search path
+    after the root is scored as a draw right away, since the side that repeated could have avoided it.
+    Positions before the root need to occur twice more, as for a threefold repetition in the game.
+    Only the positions since the last capture or pawn move can repeat. A checkmate on the move that
+    reaches the fifty-move limit still counts as a checkmate.
+*/
+static bool is_draw(struct Search_info *si, struct Position *pos, int ply) {
+    if (pos->half_move_clock >= 100) {
+        if (!pos_in_check(pos))
+            return true;
+        struct Move move_list[MAX_NUM_MOVES];
+        return generate_moves(move_list, pos) > 0;
+    }
+
+    int idx = si->game_plies + ply;
+    int oldest = idx - (int) pos->half_move_clock;
+    if (oldest < 0)
+        oldest = 0;
+    int repetitions = 0;
+    for (int i = idx - 4; i >= oldest; i -= 2) {
+        if (si->key_history[i] == pos->key) {
+            if (i > si->game_plies || ++repetitions == 2)
+                return true;
+        }
+    }
+    return false;
+}
+
+//Mate scores are stored relative to the node, so that they stay correct when the position is found at another ply.
+static int score_to_tt(int score, int ply) {
+    if (score >= MATE_BOUND)
+        return score + ply;
+    if (score <= -MATE_BOUND)
+        return score - ply;
+    return score;
+}
+
+static int score_from_tt(int score, int ply) {
+    if (score >= MATE_BOUND)
+        return score - ply;
+    if (score <= -MATE_BOUND)
+        return score + ply;
+    return score;
+}
+
+static int tb_score(struct Tb_result res, int ply) {
+    if (res.wdl == 0)
+        return 0;
+    int score = TB_WIN_SCORE - ply - res.dtm;
+    return res.wdl > 0 ? score : -score;
+}
+
+int search(struct Position *pos, struct Search_info *si, struct Move *best_move) {
+    //Positions covered by the tablebases are played perfectly without searching.
+    struct Tb_result tb_res;
+    if (popcount(pos_occupancy(pos)) <= tb_max_pieces && tb_root_move(pos, best_move, &tb_res)) {
+        int score = tb_score(tb_res, 0);
+        ++si->tb_hits;
+        si->completed_depth = 1;
+        si->pv_table[0][0] = *best_move;
+        si->pv_length[0] = 1;
+        si->root_pv[0] = *best_move;
+        si->root_pv_length = 1;
+        if (!si->silent)
+            print_iteration_info(si, 1, score);
+        return score;
+    }
+
+    if (si->tt != NULL)
+        tt_new_search(si->tt);
+
+    int max_depth = si->limits.depth;
+    if (max_depth <= 0 || max_depth >= MAX_PLY)
+        max_depth = MAX_PLY - 1;
+
+    int best_score = 0;
+    for (int depth = 1; depth <= max_depth; ++depth) {
+        struct Move iteration_move;
+        int score = negamax_root(si, pos, depth, &iteration_move);
+
+        //Results from an interrupted iteration are not reliable.
+        if (si->stop)
+            break;
+
+        best_score = score;
+        *best_move = iteration_move;
+        si->completed_depth = depth;
+        si->root_pv_length = si->pv_length[0];
+        memcpy(si->root_pv, si->pv_table[0], si->pv_length[0] * sizeof(struct Move));
+
+        if (!si->silent) {
+            print_iteration_info(si, depth, score);
+            si->last_output_time = get_time_ms();
+        }
+
+        //Checkmate or stalemate at the root, deeper iterations can't change anything.
+        if (si->root_pv_length == 0)
+            break;
+    }
+
+    //Stopped from outside before the first iteration completed: any legal move is better than none.
+    if (si->completed_depth == 0) {
+        struct Move move_list[MAX_NUM_MOVES];
+        if (generate_moves(move_list, pos) > 0) {
+            *best_move = move_list[0];
+            si->root_pv[0] = move_list[0];
+            si->root_pv_length = 1;
+        }
+    }
+
+    return best_score;
+}
+
+static void init_root_moves(struct Search_info *si, struct Position *pos) {
+    struct Move move_list[MAX_NUM_MOVES];
+    si->num_root_moves = generate_moves(move_list, pos);
+    si->root_moves = malloc((si->num_root_moves > 0 ? si->num_root_moves : 1) * sizeof(struct Root_move));
+    for (int i = 0; i < si->num_root_moves; ++i) {
+        si->root_moves[i].move = move_list[i];
+        si->root_moves[i].score = -MATE_SCORE;
+        si->root_moves[i].pv_length = 0;
+    }
+}
+
+//Insertion sort, stable so that moves with equal scores keep the order of the previous iteration.
+static void sort_root_moves(struct Search_info *si) {
+    for (int i = 1; i < si->num_root_moves; ++i) {
+        struct Root_move rm = si->root_moves[i];
+        int j = i - 1;
+        for (; j >= 0 && si->root_moves[j].score < rm.score; --j)
+            si->root_moves[j + 1] = si->root_moves[j];
+        si->root_moves[j + 1] = rm;
+    }
+}
+
+int negamax_root(struct Search_info *si, struct Position *pos, int depth, struct Move *best_move) {
+    if (si->root_moves == NULL)
+        init_root_moves(si, pos);
+    ++si->nodes;
+    STATS_INC(si, pv_nodes);
+    si->pv_length[0] = 0;
+    si->key_history[si->game_plies] = pos->key;
+
+    //Without legal moves there is no best move, only the score of checkmate or stalemate.
+    if (si->num_root_moves == 0)
+        return pos_in_check(pos) ? -MATE_SCORE : 0;
+
+    for (int i = 0; i < si->num_root_moves; ++i) {
+        struct Root_move *rm = &si->root_moves[i];
+        if (!si->silent && get_time_ms() - si->start_time >= CURRMOVE_DELAY_MS)
+            print_currmove(depth, rm->move, i + 1);
+
+        make_move(rm->move, pos, si->move_stack);
+        int score = -negamax(si, pos, depth - 1, 1, -1000000, 1000000);
+        unmake_move(rm->move, pos, si->move_stack);
+
+        if (si->stop)
+            return 0;
+
+        rm->score = score;
+        rm->pv[0] = rm->move;
+        rm->pv_length = max(si->pv_length[1], 1);
+        for (int ply = 1; ply < rm->pv_length; ++ply)
+            rm->pv[ply] = si->pv_table[1][ply];
+    }
+
+    sort_root_moves(si);
+    const struct Root_move *best = &si->root_moves[0];
+    *best_move = best->move;
+    si->pv_length[0] = best->pv_length;
+    memcpy(si->pv_table[0], best->pv, best->pv_length * sizeof(struct Move));
+    return best->score;
+}
+
+int negamax(struct Search_info *si, struct Position *pos, int depth, int ply, int alpha, int beta) {
+    si->pv_length[ply] = ply;
+
+    if ((++si->nodes & (CHECK_INTERVAL - 1)) == 0)
+        check_limits(si);
+    if (si->stop)
+        return 0;
+
+    if (ply > si->seldepth)
+        si->seldepth = ply;
+
+    si->key_history[si->game_plies + ply] = pos->key;
+    if (is_draw(si, pos, ply))
+        return 0;
+
+    //Drawn KPK positions are exact, there is no need to search them.
+    if (kpk_probe_position(pos) == KPK_DRAW)
+        return 0;
+
+    struct Tb_result tb_res;
+    if (popcount(pos_occupancy(pos)) <= tb_max_pieces && tb_probe(pos, &tb_res)) {
+        ++si->tb_hits;
+        return tb_score(tb_res, ply);
+    }
+
+    //Mate distance pruning: even mating right away can't beat a shorter mate found elsewhere in the tree,
+    //and getting mated next move can't be worse than a shorter mate against us.
+    alpha = max(alpha, -MATE_SCORE + ply);
+    beta = min(beta, MATE_SCORE - ply - 1);
+    if (alpha >= beta)
+        return alpha;
+
+    if (depth == 0 || ply >= MAX_PLY - 1) {
+        STATS_INC(si, leaf_nodes);
+        return evaluate_position(pos, pos->side_to_move);
+    }
+
+    //A deep enough result for this position is used as is, otherwise its best move is searched first.
+    uint32_t tt_move = TT_NO_MOVE;
+    struct Tt_entry tt_entry;
+    if (si->tt != NULL)
+        STATS_INC(si, tt_probes);
+    if (si->tt != NULL && tt_probe(si->tt, pos->key, &tt_entry)) {
+        STATS_INC(si, tt_hits);
+        tt_move = tt_entry.move;
+        int tt_score = score_from_tt(tt_entry.score, ply);
+        if (tt_entry.depth >= depth
+            && (tt_entry.bound == TT_EXACT
+                || (tt_entry.bound == TT_LOWER && tt_score >= beta)
+                || (tt_entry.bound == TT_UPPER && tt_score <= alpha))) {
+            if (tt_entry.bound == TT_EXACT && tt_move != TT_NO_MOVE) {
+                si->pv_table[ply][ply] = tt_decode_move(tt_move);
+                si->pv_length[ply] = ply + 1;
+            }
+            STATS_INC(si, tt_cutoffs);
+            return tt_score;
+        }
+    }
+
     struct Move* move_list = malloc(MAX_NUM_MOVES * sizeof(struct Move));
+
     int num_legal_moves = generate_moves(move_list, pos);
-    int values[num_legal_moves];
-    MS_Stack *move_stack = stk_create(16);
-    for (int i = 0; i < num_legal_moves; ++i) {
-        make_move(move_list[i], pos, move_stack);
-        values[i] = -negamax(pos, depth - 1, -1000000, 1000000);
-        unmake_move(move_list[i], pos, move_stack);
+    if (num_legal_moves == 0) {
+        free(move_list);
+        return pos_in_check(pos) ? -MATE_SCORE + ply : 0;
+    }
+
+    if (tt_move != TT_NO_MOVE) {
+        for (int i = 0; i < num_legal_moves; ++i) {
+            if (tt_encode_move(move_list[i]) == tt_move) {
+                struct Move tmp = move_list[0];
+                move_list[0] = move_list[i];
+                move_list[i] = tmp;
+                break;
+            }
+        }
     }
-    int max_val = -100000000;
-    int max_index = 0;
+
+    int value = -MATE_SCORE;
+    uint32_t best_move = TT_NO_MOVE;
+    const int original_alpha = alpha;
     for (int i = 0; i < num_legal_moves; ++i) {
-        if (values[i] > max_val) {
-            max_val = values[i];
-            *best_move = move_list[i];
+        make_move(move_list[i], pos, si->move_stack);
+        //The child probes the table after its draw and tablebase checks, leaves don't probe at all.
+        if (si->tt != NULL && depth > 1)
+            tt_prefetch(si->tt, pos->key);
+        int score = -negamax(si, pos, depth - 1, ply + 1, -beta, -alpha);
+        unmake_move(move_list[i], pos, si->move_stack);
+
+        value = max(value, score);
+        if (score > alpha) {
+            alpha = score;
+            best_move = tt_encode_move(move_list[i]);
+            update_pv(si, ply, move_list[i]);
         }
+        if (alpha >= beta) {
+            STATS_INC(si, beta_cutoffs);
+            if (i == 0)
+                STATS_INC(si, first_move_cutoffs);
+            break;
+        }
+    }
+
+#ifdef SEARCH_STATS
+    //Classify the node by its outcome: fail high, exact score or fail low.
+    if (alpha >= beta)
+        STATS_INC(si, cut_nodes);
+    else if (alpha > original_alpha)
+        STATS_INC(si, pv_nodes);
+    else
+        STATS_INC(si, all_nodes);
+#endif
+
+    //The result of an interrupted search is incomplete.
+    if (si->tt != NULL && !si->stop) {
+        enum Tt_bound bound = (value >= beta) ? TT_LOWER : (value > original_alpha) ? TT_EXACT : TT_UPPER;
+        tt_store(si->tt, pos->key, depth, score_to_tt(value, ply), bound, best_move);
     }
+
     free(move_list);
-    return max_val;
+    return value;
 }
 
-int negamax(struct Position *pos, int depth, int alpha, int beta) {
-    if (depth == 0)
-        return evaluate_position(pos, pos->side_to_move);
+int quiescence(struct Search_info *si, struct Position *pos, int ply, int alpha, int beta) {
+    si->pv_length[ply] = ply;
 
-    struct Move* move_list = malloc(MAX_NUM_MOVES * sizeof(struct Move));
+    if ((++si->nodes & (CHECK_INTERVAL - 1)) == 0)
+        check_limits(si);
+    if (si->stop)
+        return 0;
+
+    if (ply > si->seldepth)
+        si->seldepth = ply;
 
+    int stand_pat = evaluate_position(pos, pos->side_to_move);
+    if (stand_pat >= beta || ply >= MAX_PLY - 1)
+        return stand_pat;
+    if (stand_pat > alpha)
+        alpha = stand_pat;
+
+    struct Move* move_list = malloc(MAX_NUM_MOVES * sizeof(struct Move));
     int num_legal_moves = generate_moves(move_list, pos);
-    int value = -10000;
-    MS_Stack *move_stack = stk_create(16);
+    int value = stand_pat;
     for (int i = 0; i < num_legal_moves; ++i) {
-        make_move(move_list[i], pos, move_stack);
-        value = max(value, -negamax(pos, depth - 1, -beta, -alpha));
-        unmake_move(move_list[i], pos, move_stack);
-        alpha = max(alpha, value);
+        struct Move move = move_list[i];
+        if (pos->piece_list[move.to_sq] == PIECE_EMPTY && !move.en_passant && move.promotion_type == PT_NULL)
+            continue;
+
+        make_move(move, pos, si->move_stack);
+        int score = -quiescence(si, pos, ply + 1, -beta, -alpha);
+        unmake_move(move, pos, si->move_stack);
+
+        value = max(value, score);
+        if (score > alpha) {
+            alpha = score;
+            update_pv(si, ply, move);
+        }
         if (alpha >= beta)
             break;
     }
 
-    stk_destroy(move_stack);
     free(move_list);
     return value;
-}
\ No newline at end of file
+}
@@ -1,9 +1,135 @@
 #ifndef SEARCH_H
 #define SEARCH_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+
 #include "position.h"
+#include "stack.h"
+#include "tt.h"
+#include "types.h"
+
+#define MAX_PLY 64
+//Positions of the game before the root that are kept for repetition detection.
+#define MAX_GAME_HISTORY 256
+
+//Score of a position won according to the tablebases, minus the plies to mate.
+#define TB_WIN_SCORE 9000
+
+//Score of giving checkmate at the root. A mate delivered at ply scores MATE_SCORE - ply, so that shorter
+//mates are preferred. Scores beyond MATE_BOUND in absolute value are mate scores.
+#define MATE_SCORE 30000
+#define MATE_BOUND (MATE_SCORE - MAX_PLY)
+
+//Limits for a single search. A value of 0 means that there is no limit of that kind.
+struct Search_limits {
+    int depth;
+    unsigned long movetime; //In milliseconds
+    u64 nodes;
+    //Number of best lines reported, 0 or 1 for just the best move.
+    int multipv;
+};
+
+#ifdef SEARCH_STATS
+//Counters used to tune the search, only collected when built with SEARCH_STATS.
+struct Search_stats {
+    u64 pv_nodes;
+    u64 cut_nodes;
+    u64 all_nodes;
+    u64 leaf_nodes;
+    u64 beta_cutoffs;
+    u64 first_move_cutoffs;
+    u64 tt_probes;
+    u64 tt_hits;
+    u64 tt_cutoffs;
+};
+
+#define STATS_INC(si, counter) (++(si)->stats.counter)
+
+void search_stats_add(struct Search_stats *dst, const struct Search_stats *src);
+void print_search_stats(const struct Search_stats *stats);
+#else
+#define STATS_INC(si, counter) ((void) 0)
+#endif
+
+//A legal move at the root, with its score and principal variation from the last search of the move.
+struct Root_move {
+    struct Move move;
+    int score;
+    int pv_length;
+    struct Move pv[MAX_PLY];
+};
+
+//State of a search that is running in a single thread.
+struct Search_info {
+    struct Search_limits limits;
+
+    //If set, no UCI info lines are printed during the search.
+    bool silent;
+    //Set when a limit is reached, or by another thread to interrupt the search.
+    atomic_bool stop;
+    //While set, the search is pondering and the limits are not enforced. Cleared by ponderhit.
+    atomic_bool ponder;
+
+    u64 nodes;
+    u64 tb_hits;
+    int seldepth;
+    int completed_depth;
+
+    long long start_time;
+    long long last_output_time;
+
+    MS_Stack *move_stack;
+
+    //Transposition table, or NULL to search without one. Not owned by the search.
+    struct Tt *tt;
+
+    //Keys of the game positions before the root, followed by the keys of the positions on the current
+    //search path: the position at ply is at key_history[game_plies + ply].
+    u64 key_history[MAX_GAME_HISTORY + MAX_PLY];
+    int game_plies;
+
+#ifdef SEARCH_STATS
+    struct Search_stats stats;
+#endif
+
+    //Triangular PV table, pv_table[ply] holds the principal variation starting at ply.
+    int pv_length[MAX_PLY];
+    struct Move pv_table[MAX_PLY][MAX_PLY];
+
+    //Legal moves at the root, sorted by score after every completed iteration. Generated by the first
+    //call to negamax_root.
+    struct Root_move *root_moves;
+    int num_root_moves;
+
+    //Principal variation of the last completed iteration, empty if the root has no legal moves.
+    int root_pv_length;
+    struct Move root_pv[MAX_PLY];
+};
+
+//Monotonic wall clock time in milliseconds.
+long long get_time_ms(void);
+
+void search_info_init(struct Search_info *si, struct Search_limits limits);
+void search_info_destroy(struct Search_info *si);
+
+//Sets the keys of the game positions before the root, oldest first, for repetition detection.
+//Only the last MAX_GAME_HISTORY keys are kept. Must be called after search_info_init.
+void search_info_set_history(struct Search_info *si, const u64 *keys, int num_keys);
+
+//Turns a pondering search into a normal one, with the movetime counted from now. Can be called from
+//another thread while the search is running. Does nothing unless the search is pondering.
+void search_ponderhit(struct Search_info *si);
+
+//Iterative deepening search up to the limits in si. Returns the score of the best move.
+int search(struct Position *pos, struct Search_info *si, struct Move *best_move);
+
+//Searches every root move with a full window, so all of their scores are exact, and sorts them best first.
+int negamax_root(struct Search_info *si, struct Position *pos, int depth, struct Move *best_move);
+int negamax(struct Search_info *si, struct Position *pos, int depth, int ply, int alpha, int beta);
 
-int negamax_root(struct Position *pos, int depth, struct Move *best_move);
-int negamax(struct Position *pos, int depth, int alpha, int beta);
+//Searches captures and promotions until the position is quiet. The side to move can always stand pat,
+//also when in check. The principal variation leads to the quiet position the score comes from.
+int quiescence(struct Search_info *si, struct Position *pos, int ply, int alpha, int beta);
 
 #endif
@@ -0,0 +1,456 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitboard.h"
+#include "movegen.h"
+#include "tablebase.h"
+#include "tables.h"
+#include "zobrist.h"
+
+#define TB_MAGIC "CB2TB001"
+#define TB_HEADER_SZ 64
+#define TB_FILE_EXT ".cbtb"
+#define MAX_TABLES 64
+#define MAX_NUM_MOVES 256
+
+/*
+    Indexing: the side to move, the square of the white king and 6 bits for every other piece.
+    Symmetry is used to restrict the white king to files A-D, and for pawnless tables also to ranks 1-4.
+    None of those reflections has a fixed square, so every position has exactly one canonical form.
+*/
+
+struct Tb_header {
+    char magic[8];
+    uint32_t num_pieces;
+    uint32_t reserved;
+    u64 num_entries;
+    char name[TB_NAME_SZ];
+};
+
+struct Tb_table {
+    struct Tb_material mat;
+    unsigned material_key;
+    const unsigned char *data;
+    const void *map;
+    size_t map_size;
+};
+
+static struct Tb_table tables[MAX_TABLES];
+static int num_tables = 0;
+int tb_max_pieces = 0;
+
+//Piece letters indexed by piece type.
+static const char *name_chars = "PNBRQK";
+
+//Counts of every piece type except the kings, packed 2 bits per count, used to find the table of a
+//position quickly. With at most TB_MAX_PIECES pieces, two of them kings, no count exceeds 2.
+static unsigned material_key_from_counts(const int counts[2][6]) {
+    unsigned key = 0;
+    for (int side = WHITE; side <= BLACK; ++side) {
+        for (int pt = PAWN; pt <= QUEEN; ++pt)
+            key = (key << 2) | (unsigned) counts[side][pt];
+    }
+    return key;
+}
+
+static unsigned material_key(const struct Tb_material *mat, bool color_flipped) {
+    int counts[2][6] = {{0}};
+    for (int i = 0; i < mat->num_pieces; ++i) {
+        enum Side color = piece_color(mat->pieces[i]);
+        counts[color_flipped ? !color : color][to_piece_type(mat->pieces[i])]++;
+    }
+    return material_key_from_counts(counts);
+}
+
+//Compares the pieces (without king) of the two sides as strings of piece types.
+//Returns a positive value if a is stronger than b.
+static int compare_sides(const enum Piece_type *a, int num_a, const enum Piece_type *b, int num_b) {
+    if (num_a != num_b)
+        return num_a - num_b;
+    for (int i = 0; i < num_a; ++i) {
+        if (a[i] != b[i])
+            return (int) a[i] - (int) b[i];
+    }
+    return 0;
+}
+
+static void build_material(struct Tb_material *mat, const enum Piece_type *white, int num_white,
+                           const enum Piece_type *black, int num_black) {
+    int n = 0;
+    int idx = 0;
+    mat->has_pawns = false;
+    mat->pieces[n++] = WHITE_KING;
+    mat->name[idx++] = 'K';
+    for (int i = 0; i < num_white; ++i) {
+        mat->pieces[n++] = to_colored_piece(white[i], WHITE);
+        mat->name[idx++] = name_chars[white[i]];
+        mat->has_pawns |= white[i] == PAWN;
+    }
+    mat->name[idx++] = 'v';
+    mat->pieces[n++] = BLACK_KING;
+    mat->name[idx++] = 'K';
+    for (int i = 0; i < num_black; ++i) {
+        mat->pieces[n++] = to_colored_piece(black[i], BLACK);
+        mat->name[idx++] = name_chars[black[i]];
+        mat->has_pawns |= black[i] == PAWN;
+    }
+    mat->name[idx] = '\0';
+    mat->num_pieces = n;
+}
+
+//Parses one side of a name, e.g. "KRP". Pieces must be given in descending order.
+static int parse_side(const char *str, size_t len, enum Piece_type *pts) {
+    if (len == 0 || str[0] != 'K')
+        return -1;
+
+    int n = 0;
+    for (size_t i = 1; i < len; ++i) {
+        const char *c = strchr(name_chars, str[i]);
+        if (c == NULL || *c == '\0' || *c == 'K')
+            return -1;
+        pts[n] = (enum Piece_type) (c - name_chars);
+        if (n > 0 && pts[n] > pts[n - 1])
+            return -1;
+        ++n;
+    }
+
+    return n;
+}
+
+bool tb_material_from_name(const char *name, struct Tb_material *mat) {
+    const char *v = strchr(name, 'v');
+    if (v == NULL)
+        return false;
+
+    enum Piece_type white[TB_MAX_PIECES];
+    enum Piece_type black[TB_MAX_PIECES];
+    if (strlen(name) > TB_MAX_PIECES + 1)
+        return false;
+    int num_white = parse_side(name, v - name, white);
+    int num_black = parse_side(v + 1, strlen(v + 1), black);
+    if (num_white < 0 || num_black < 0 || num_white + num_black == 0
+        || num_white + num_black + 2 > TB_MAX_PIECES
+        || compare_sides(white, num_white, black, num_black) < 0)
+        return false;
+
+    build_material(mat, white, num_white, black, num_black);
+    return true;
+}
+
+static int count_pawns(const struct Tb_material *mat) {
+    int pawns = 0;
+    for (int i = 0; i < mat->num_pieces; ++i)
+        pawns += to_piece_type(mat->pieces[i]) == PAWN;
+    return pawns;
+}
+
+static int dependency_order(const void *a, const void *b) {
+    const struct Tb_material *ma = a;
+    const struct Tb_material *mb = b;
+    if (ma->num_pieces != mb->num_pieces)
+        return ma->num_pieces - mb->num_pieces;
+    //Promotions turn pawns into pieces, so tables with fewer pawns come first.
+    return count_pawns(ma) - count_pawns(mb);
+}
+
+//All ways to pick up to two non-king pieces for one side, in descending order.
+static int side_combinations(enum Piece_type combos[][2], int *sizes, int max_extra) {
+    int n = 0;
+    sizes[n++] = 0;
+    for (int p0 = QUEEN; p0 >= PAWN && max_extra >= 1; --p0) {
+        combos[n][0] = p0;
+        sizes[n++] = 1;
+        for (int p1 = p0; p1 >= PAWN && max_extra >= 2; --p1) {
+            combos[n][0] = p0;
+            combos[n][1] = p1;
+            sizes[n++] = 2;
+        }
+    }
+
+    return n;
+}
+
+int tb_all_materials(struct Tb_material *mats, int max_mats, int max_pieces) {
+    enum Piece_type combos[32][2];
+    int sizes[32];
+    int num_combos = side_combinations(combos, sizes, max_pieces - 2);
+
+    int n = 0;
+    for (int w = 0; w < num_combos; ++w) {
+        for (int b = 0; b < num_combos; ++b) {
+            if (sizes[w] + sizes[b] == 0 || sizes[w] + sizes[b] > max_pieces - 2
+                || compare_sides(combos[w], sizes[w], combos[b], sizes[b]) < 0 || n >= max_mats)
+                continue;
+            build_material(&mats[n++], combos[w], sizes[w], combos[b], sizes[b]);
+        }
+    }
+
+    qsort(mats, n, sizeof(struct Tb_material), dependency_order);
+    return n;
+}
+
+u64 tb_table_size(const struct Tb_material *mat) {
+    u64 size = 2 * (mat->has_pawns ? 32 : 16);
+    for (int i = 1; i < mat->num_pieces; ++i)
+        size *= 64;
+    return size;
+}
+
+//The white king is on files A-D, and for pawnless tables on ranks 1-4 as well.
+static inline int king_index(enum Square sq) {
+    return sq_rank(sq) * 4 + sq_file(sq);
+}
+
+bool tb_index_to_position(const struct Tb_material *mat, u64 idx, struct Position *pos) {
+    enum Square squares[TB_MAX_PIECES];
+    for (int i = mat->num_pieces - 1; i >= 1; --i) {
+        squares[i] = (enum Square) (idx & 63);
+        idx >>= 6;
+    }
+
+    int king_squares = mat->has_pawns ? 32 : 16;
+    int king_idx = (int) (idx % king_squares);
+    squares[0] = file_rank_sq((enum File) (king_idx % 4), (enum Rank) (king_idx / 4));
+    enum Side stm = (enum Side) (idx / king_squares);
+
+    memset(pos, 0, sizeof(struct Position));
+    for (int i = 0; i < mat->num_pieces; ++i) {
+        enum Square sq = squares[i];
+        if (pos->piece_list[sq] != PIECE_EMPTY)
+            return false;
+        //Identical pieces must be stored in ascending order.
+        if (i > 0 && mat->pieces[i] == mat->pieces[i - 1] && sq < squares[i - 1])
+            return false;
+        if (to_piece_type(mat->pieces[i]) == PAWN && (sq_rank(sq) == RANK_1 || sq_rank(sq) == RANK_8))
+            return false;
+        pos->piece_list[sq] = mat->pieces[i];
+    }
+
+    pos_from_piece_list(pos);
+    pos->side_to_move = stm;
+    pos->ep_square = SQUARE_EMPTY;
+    pos->fullmove_count = 1;
+    pos->key = compute_key(pos);
+    pos->checkers = compute_checkers(pos);
+
+    return true;
+}
+
+u64 tb_position_to_index(const struct Tb_material *mat, const struct Position *pos, bool color_flipped) {
+    enum Square squares[TB_MAX_PIECES];
+    int i = 0;
+    //Collect the squares in the order of the pieces in the table.
+    while (i < mat->num_pieces) {
+        enum Piece piece = mat->pieces[i];
+        enum Side color = piece_color(piece);
+        enum Side pos_color = color_flipped ? !color : color;
+        u64 bb = pos->piece_bb[to_piece_type(piece)][pos_color];
+        while (bb) {
+            enum Square sq = pop_lsb(&bb);
+            squares[i++] = color_flipped ? sq ^ 56 : sq;
+        }
+    }
+
+    //Reflect the board so that the white king ends up in the canonical region.
+    int flip = 0;
+    if (sq_file(squares[0]) > FILE_D)
+        flip ^= 7;
+    if (!mat->has_pawns && sq_rank(squares[0]) > RANK_4)
+        flip ^= 56;
+    for (i = 0; i < mat->num_pieces; ++i)
+        squares[i] ^= flip;
+
+    //Identical pieces are stored in ascending order, reflections may have changed the order.
+    for (i = 1; i < mat->num_pieces; ++i) {
+        if (mat->pieces[i] == mat->pieces[i - 1] && squares[i] < squares[i - 1]) {
+            enum Square tmp = squares[i];
+            squares[i] = squares[i - 1];
+            squares[i - 1] = tmp;
+        }
+    }
+
+    enum Side stm = color_flipped ? !pos->side_to_move : pos->side_to_move;
+    u64 idx = (u64) stm * (mat->has_pawns ? 32 : 16) + king_index(squares[0]);
+    for (i = 1; i < mat->num_pieces; ++i)
+        idx = (idx << 6) | squares[i];
+
+    return idx;
+}
+
+bool tb_write(const char *dir, const struct Tb_material *mat, const unsigned char *data) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s%s", dir, mat->name, TB_FILE_EXT);
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+
+    unsigned char header_buff[TB_HEADER_SZ] = {0};
+    struct Tb_header header = {0};
+    memcpy(header.magic, TB_MAGIC, 8);
+    header.num_pieces = mat->num_pieces;
+    header.num_entries = tb_table_size(mat);
+    memcpy(header.name, mat->name, TB_NAME_SZ);
+    memcpy(header_buff, &header, sizeof(header));
+
+    bool ok = fwrite(header_buff, 1, TB_HEADER_SZ, f) == TB_HEADER_SZ
+           && fwrite(data, 1, header.num_entries, f) == header.num_entries;
+    return fclose(f) == 0 && ok;
+}
+
+static bool map_table(const char *dir, const struct Tb_material *mat, struct Tb_table *table) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s%s", dir, mat->name, TB_FILE_EXT);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    u64 expected_size = TB_HEADER_SZ + tb_table_size(mat);
+    if (fstat(fd, &st) != 0 || (u64) st.st_size != expected_size) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const struct Tb_header *header = map;
+    if (memcmp(header->magic, TB_MAGIC, 8) != 0 || header->num_entries != tb_table_size(mat)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    table->mat = *mat;
+    table->material_key = material_key(mat, false);
+    table->map = map;
+    table->map_size = st.st_size;
+    table->data = (const unsigned char*) map + TB_HEADER_SZ;
+    return true;
+}
+
+void tb_free(void) {
+    for (int i = 0; i < num_tables; ++i)
+        munmap((void*) tables[i].map, tables[i].map_size);
+    num_tables = 0;
+    tb_max_pieces = 0;
+}
+
+int tb_init(const char *dir) {
+    tb_free();
+
+    struct Tb_material mats[MAX_TABLES];
+    int num_mats = tb_all_materials(mats, MAX_TABLES, TB_MAX_PIECES);
+    for (int i = 0; i < num_mats && num_tables < MAX_TABLES; ++i) {
+        if (map_table(dir, &mats[i], &tables[num_tables])) {
+            if (mats[i].num_pieces > tb_max_pieces)
+                tb_max_pieces = mats[i].num_pieces;
+            ++num_tables;
+        }
+    }
+
+    return num_tables;
+}
+
+bool tb_probe(const struct Position *pos, struct Tb_result *res) {
+    //Castling rights and en passant captures are not part of the tables.
+    //An en passant square without a pawn that can capture on it doesn't matter.
+    if ((pos->ep_square != SQUARE_EMPTY
+         && (attack_set.pawn[!pos->side_to_move][pos->ep_square] & pos->piece_bb[PAWN][pos->side_to_move]))
+        || pos->can_kingside_castle[WHITE] || pos->can_queenside_castle[WHITE]
+        || pos->can_kingside_castle[BLACK] || pos->can_queenside_castle[BLACK])
+        return false;
+
+    int counts[2][6];
+    int num_pieces = 0;
+    for (int side = WHITE; side <= BLACK; ++side) {
+        for (int pt = PAWN; pt <= KING; ++pt) {
+            counts[side][pt] = popcount(pos->piece_bb[pt][side]);
+            num_pieces += counts[side][pt];
+        }
+    }
+
+    if (num_pieces == 2) {
+        res->wdl = 0;
+        res->dtm = 0;
+        return true;
+    }
+
+    if (num_pieces > tb_max_pieces)
+        return false;
+
+    unsigned key = material_key_from_counts(counts);
+    int flipped_counts[2][6];
+    memcpy(flipped_counts[WHITE], counts[BLACK], sizeof(counts[BLACK]));
+    memcpy(flipped_counts[BLACK], counts[WHITE], sizeof(counts[WHITE]));
+    unsigned flipped_key = material_key_from_counts(flipped_counts);
+
+    for (int i = 0; i < num_tables; ++i) {
+        bool color_flipped;
+        if (tables[i].material_key == key)
+            color_flipped = false;
+        else if (tables[i].material_key == flipped_key)
+            color_flipped = true;
+        else
+            continue;
+
+        unsigned char value = tables[i].data[tb_position_to_index(&tables[i].mat, pos, color_flipped)];
+        if (value == TB_INVALID)
+            return false;
+        *res = tb_decode_value(value);
+        return true;
+    }
+
+    return false;
+}
+
+//Orders results from the point of view of the side to move, higher is better.
+static int result_rank(struct Tb_result res) {
+    if (res.wdl > 0)
+        return 1000 - res.dtm;
+    if (res.wdl < 0)
+        return -1000 + res.dtm;
+    return 0;
+}
+
+bool tb_root_move(struct Position *pos, struct Move *move, struct Tb_result *res) {
+    struct Tb_result root_res;
+    if (!tb_probe(pos, &root_res))
+        return false;
+
+    struct Move move_list[MAX_NUM_MOVES];
+    int num_moves = generate_moves(move_list, pos);
+    MS_Stack *move_stack = stk_create(4);
+    bool found = false;
+    int best_rank = -100000;
+
+    for (int i = 0; i < num_moves; ++i) {
+        struct Tb_result child;
+        make_move(move_list[i], pos, move_stack);
+        bool probed = tb_probe(pos, &child);
+        unmake_move(move_list[i], pos, move_stack);
+        if (!probed)
+            continue;
+
+        struct Tb_result ours = { -child.wdl, child.wdl ? child.dtm + 1 : 0 };
+        int rank = result_rank(ours);
+        if (!found || rank > best_rank) {
+            found = true;
+            best_rank = rank;
+            *move = move_list[i];
+            *res = ours;
+        }
+    }
+
+    stk_destroy(move_stack);
+    return found;
+}
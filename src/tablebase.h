@@ -0,0 +1,83 @@
+#ifndef TABLEBASE_H
+#define TABLEBASE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "position.h"
+#include "types.h"
+
+#define TB_MAX_PIECES 4
+#define TB_NAME_SZ 16
+
+/*
+    Entries in a table are one byte per position, from the point of view of the side to move:
+    0 is a draw, 1-127 a win in that many plies, and 128 + n a loss in n plies (128 means checkmated).
+    Entries for impossible positions hold TB_INVALID.
+*/
+#define TB_DRAW 0
+#define TB_LOSS_OFFSET 128
+#define TB_MAX_DTM 124
+#define TB_INVALID 255
+
+//Material of a table. pieces[] holds the white king, the other white pieces, the black king
+//and the other black pieces, in that order. Identical pieces are next to each other.
+struct Tb_material {
+    int num_pieces;
+    enum Piece pieces[TB_MAX_PIECES];
+    bool has_pawns;
+    char name[TB_NAME_SZ]; //E.g. KQvKR
+};
+
+struct Tb_result {
+    int wdl; //1 if the side to move wins, 0 for a draw and -1 for a loss.
+    int dtm; //Distance to mate in plies.
+};
+
+static inline unsigned char tb_encode_value(int wdl, int dtm) {
+    return (wdl == 0) ? TB_DRAW : (wdl > 0) ? (unsigned char) dtm : (unsigned char) (TB_LOSS_OFFSET + dtm);
+}
+
+static inline struct Tb_result tb_decode_value(unsigned char value) {
+    struct Tb_result res = { 0, 0 };
+    if (value != TB_DRAW && value != TB_INVALID) {
+        res.wdl = (value < TB_LOSS_OFFSET) ? 1 : -1;
+        res.dtm = (value < TB_LOSS_OFFSET) ? value : value - TB_LOSS_OFFSET;
+    }
+    return res;
+}
+
+//Parses a name such as KRvKP. Returns false if it isn't a canonical name of a supported table.
+bool tb_material_from_name(const char *name, struct Tb_material *mat);
+
+//Fills mat with all canonical tables of up to max_pieces pieces, ordered so that each table only
+//depends on tables earlier in the list. Returns the number of tables.
+int tb_all_materials(struct Tb_material *mats, int max_mats, int max_pieces);
+
+u64 tb_table_size(const struct Tb_material *mat);
+
+//Builds the position of index idx, side to move included. Returns false if the index doesn't
+//correspond to a (canonical) placement of the pieces.
+bool tb_index_to_position(const struct Tb_material *mat, u64 idx, struct Position *pos);
+
+//Index of a position with the material of the table, or of its color flipped counterpart.
+u64 tb_position_to_index(const struct Tb_material *mat, const struct Position *pos, bool color_flipped);
+
+//Writes the table to <dir>/<name>.cbtb.
+bool tb_write(const char *dir, const struct Tb_material *mat, const unsigned char *data);
+
+//Memory maps all tables that can be found in the directory. Any previously mapped tables are released.
+//Returns the number of tables found.
+int tb_init(const char *dir);
+void tb_free(void);
+
+//Largest number of pieces of any loaded table, 0 if no tables are loaded.
+extern int tb_max_pieces;
+
+//Probes the tables for the position. Returns false if the position isn't covered by the loaded tables.
+bool tb_probe(const struct Position *pos, struct Tb_result *res);
+
+//Picks the move that wins fastest, or draws, or loses slowest, for a position covered by the tables.
+bool tb_root_move(struct Position *pos, struct Move *move, struct Tb_result *res);
+
+#endif
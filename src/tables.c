@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include "attacks.h"
+#include "bitbase.h"
 #include "bitboard.h"
 #include "position.h"
 #include "tables.h"
@@ -20,6 +21,8 @@ void init_LUTs() {
     fill_attack_rays();
     fill_attack_sets();
     fill_inbetween_LUT();
+    //The bitbase generation uses the attack sets, so it must come last.
+    kpk_init();
 }
 
 void fill_attack_rays() {
@@ -2,15 +2,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "attacks.h"
+#include "bitbase.h"
 #include "bitboard.h"
+#include "evaluation.h"
+#include "fen.h"
 #include "position.h"
 #include "movegen.h"
+#include "packed.h"
+#include "search.h"
 #include "stack.h"
+#include "tablebase.h"
 #include "tables.h"
 #include "tests.h"
+#include "tt.h"
 #include "types.h"
+#include "zobrist.h"
 
 void run_all_tests() {
     printf("Starting tests...\n");
@@ -18,6 +27,10 @@ void run_all_tests() {
     printf("LUT initialization passed\n");
     test_FEN();
     printf("FEN passed\n");
+    test_fen_parse();
+    printf("FEN parser passed\n");
+    test_packed_position();
+    printf("Packed position test passed\n");
     test_bitshifts();
     printf("Bitshift test passed\n");
     test_attack_sets();
@@ -26,18 +39,44 @@ void run_all_tests() {
     printf("Ray attacks test passed\n");
     test_attacks_from();
     printf("Attacks_from test passed\n");
+    test_setwise_attacks();
+    printf("Set-wise attacks test passed\n");
     test_movegen();
     printf("Move generation test passed\n");
+    test_evasions();
+    printf("Evasion generation test passed\n");
     test_in_between_LUT();
     printf("in_between_LUT test passed\n");
     test_attackers_to();
     printf("attackers_to test passed\n");
+    test_attack_info();
+    printf("Attack info test passed\n");
     test_make_move();
     printf("make / unmake move test passed\n");
     test_stack();
     printf("Stack test passed\n");
     test_legal_move_check();
     printf("Legal move check test passed\n");
+    test_zobrist();
+    printf("Zobrist key test passed\n");
+    test_checkers();
+    printf("Checkers test passed\n");
+    test_gives_check();
+    printf("Gives check test passed\n");
+    test_kpk();
+    printf("KPK bitbase test passed\n");
+    test_tablebase_index();
+    printf("Tablebase index test passed\n");
+    test_evaluate_position();
+    printf("Evaluation terms test passed\n");
+    test_mate_scores();
+    printf("Mate score test passed\n");
+    test_draws();
+    printf("Draw test passed\n");
+    test_tt();
+    printf("Transposition table test passed\n");
+    test_root_moves();
+    printf("Root move list test passed\n");
     printf("All tests passed!\n");
 }
 
@@ -75,6 +114,128 @@ void test_FEN() {
     assert(pos.half_move_clock == 0);
 }
 
+void test_fen_parse() {
+    init_LUTs();
+    const char *fens[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq c6 0 2",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 12 40"
+    };
+
+    //Same result as pos_from_FEN, also without a NUL terminator at the end of the FEN.
+    for (int i = 0; i < 4; ++i) {
+        struct Position expected = pos_from_FEN(fens[i]);
+        struct Position pos;
+        const char *next;
+        const char *end = fens[i] + strlen(fens[i]);
+        assert(fen_parse(fens[i], end, &pos, &next) == FEN_OK);
+        assert(next == end);
+        assert(memcmp(pos.piece_list, expected.piece_list, sizeof(pos.piece_list)) == 0);
+        assert(memcmp(pos.piece_bb, expected.piece_bb, sizeof(pos.piece_bb)) == 0);
+        assert(pos.side_to_move == expected.side_to_move && pos.ep_square == expected.ep_square);
+        assert(pos.can_kingside_castle[WHITE] == expected.can_kingside_castle[WHITE]);
+        assert(pos.can_queenside_castle[BLACK] == expected.can_queenside_castle[BLACK]);
+        assert(pos.half_move_clock == expected.half_move_clock);
+        assert(pos.fullmove_count == expected.fullmove_count);
+    }
+
+    //EPD without clocks, the operations are left unparsed.
+    struct Position pos;
+    const char *epd = "4k3/8/8/8/8/8/4P3/4K3 b - - bm Kd7; id \"test\";";
+    const char *next;
+    assert(fen_parse(epd, epd + strlen(epd), &pos, &next) == FEN_OK);
+    assert(strncmp(next, " bm", 3) == 0 && pos.fullmove_count == 1);
+
+    //A FEN cut off by the end of the buffer
+    const char *start = fens[0];
+    assert(fen_parse(start, start + 20, &pos, NULL) == FEN_BAD_BOARD);
+    assert(fen_parse(start, start + 44, &pos, NULL) == FEN_BAD_SIDE);
+
+    const char *bad_board = "rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+    const char *no_king = "4k1RQ/3PPP2/6B1/8/8/8/8/8 b - - 0 1";
+    const char *pawn_rank = "4k2P/8/8/8/8/8/8/4K3 w - - 0 1";
+    const char *bad_side = "4k3/8/8/8/8/8/8/4K3 x - - 0 1";
+    const char *bad_castling = "4k3/8/8/8/8/8/8/4K3 w K - 0 1";
+    const char *bad_ep = "4k3/8/8/8/8/8/8/4K3 w - e3 0 1";
+    const char *bad_clock = "4k3/8/8/8/8/8/8/4K3 w - - 1x 1";
+    const char *in_check = "4k3/8/8/8/8/8/8/K3R3 b - - 0 1";
+    const char *illegal_check = "4k3/4R3/8/8/8/8/8/4K3 w - - 0 1";
+    assert(fen_parse(bad_board, bad_board + strlen(bad_board), &pos, NULL) == FEN_BAD_BOARD);
+    assert(fen_parse(no_king, no_king + strlen(no_king), &pos, NULL) == FEN_BAD_KINGS);
+    assert(fen_parse(pawn_rank, pawn_rank + strlen(pawn_rank), &pos, NULL) == FEN_BAD_PAWNS);
+    assert(fen_parse(bad_side, bad_side + strlen(bad_side), &pos, NULL) == FEN_BAD_SIDE);
+    assert(fen_parse(bad_castling, bad_castling + strlen(bad_castling), &pos, NULL) == FEN_BAD_CASTLING);
+    assert(fen_parse(bad_ep, bad_ep + strlen(bad_ep), &pos, NULL) == FEN_BAD_EP);
+    assert(fen_parse(bad_clock, bad_clock + strlen(bad_clock), &pos, NULL) == FEN_BAD_CLOCK);
+    assert(fen_parse(in_check, in_check + strlen(in_check), &pos, NULL) == FEN_OK);
+    assert(fen_parse(illegal_check, illegal_check + strlen(illegal_check), &pos, NULL) == FEN_IN_CHECK);
+}
+
+void test_packed_position() {
+    const char *fens[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w Kq - 3 10",
+        "rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq c6 0 2",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 b - - 12 40"
+    };
+    const char *path = "packed_test.bin";
+
+    struct Packed_writer writer;
+    assert(packed_writer_open(&writer, path));
+    for (int i = 0; i < 4; ++i) {
+        struct Position pos = pos_from_FEN(fens[i]);
+        struct Packed_position packed;
+        struct Position decoded;
+        char fen[FEN_MAX_LEN + 1];
+        assert(pack_position(&pos, &packed));
+        assert(unpack_position(&packed, &decoded));
+        pos_to_FEN(&decoded, fen);
+        assert(strcmp(fen, fens[i]) == 0);
+        assert(memcmp(decoded.piece_bb, pos.piece_bb, sizeof(pos.piece_bb)) == 0);
+        assert(memcmp(decoded.occupied_squares, pos.occupied_squares, sizeof(pos.occupied_squares)) == 0);
+
+        packed.score = (int16_t) (i * 100 - 150);
+        packed.result = PACKED_DRAW;
+        assert(packed_writer_write(&writer, &packed, 1));
+    }
+    assert(packed_writer_close(&writer));
+
+    //Records are read back in any order.
+    struct Packed_file file;
+    assert(packed_file_open(&file, path));
+    assert(file.count == 4);
+    for (int i = 3; i >= 0; --i) {
+        struct Position decoded;
+        char fen[FEN_MAX_LEN + 1];
+        assert(unpack_position(&file.records[i], &decoded));
+        pos_to_FEN(&decoded, fen);
+        assert(strcmp(fen, fens[i]) == 0);
+        assert(file.records[i].score == i * 100 - 150 && file.records[i].result == PACKED_DRAW);
+    }
+
+    //Corrupt records are rejected: an invalid piece code, a board without a black king and en passant
+    //squares that are off the board or on the wrong rank.
+    struct Packed_position corrupt = file.records[0];
+    struct Position decoded;
+    corrupt.pieces[0] |= 0xF;
+    assert(!unpack_position(&corrupt, &decoded));
+    corrupt = file.records[0];
+    for (int i = 0; i < 16; ++i)
+        for (int half = 0; half < 2; ++half)
+            if (((corrupt.pieces[i] >> (4 * half)) & 0xF) == BLACK_KING)
+                corrupt.pieces[i] ^= (uint8_t) ((BLACK_KING ^ BLACK_QUEEN) << (4 * half));
+    assert(!unpack_position(&corrupt, &decoded));
+    corrupt = file.records[2];
+    assert(unpack_position(&corrupt, &decoded));
+    corrupt.ep_square = 0xFF;
+    assert(!unpack_position(&corrupt, &decoded));
+    corrupt.ep_square = c3;
+    assert(!unpack_position(&corrupt, &decoded));
+    packed_file_close(&file);
+    remove(path);
+}
+
 void test_bitshifts() {
     u64 test_bb;
     test_bb = set_bit(e4);
@@ -153,6 +314,35 @@ void test_attacks_from() {
     print_bitboard(attacks_rook);
 }
 
+void test_setwise_attacks() {
+    init_LUTs();
+    const char *fens[] = {
+        "8/4rn2/4k3/2B5/3P1Q2/4K3/8/5R1b w - - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "B6b/8/8/8/2rR4/8/8/b1q3KR w - - 0 1"
+    };
+
+    //The set-wise attacks of all sliders of a type equal the union of their attacks one at a time.
+    for (size_t i = 0; i < sizeof(fens) / sizeof(fens[0]); ++i) {
+        struct Position pos = pos_from_FEN(fens[i]);
+        u64 empty = ~pos_occupancy(&pos);
+        for (enum Side side = WHITE; side <= BLACK; ++side) {
+            enum Piece_type types[] = {BISHOP, ROOK, QUEEN};
+            for (int t = 0; t < 3; ++t) {
+                u64 sliders = pos.piece_bb[types[t]][side];
+                u64 expected = 0ULL;
+                for (u64 bb = sliders; bb;)
+                    expected |= attacks_from(types[t], &pos, pop_lsb(&bb));
+
+                u64 setwise = types[t] == BISHOP ? bishop_attacks_setwise(sliders, empty)
+                              : types[t] == ROOK ? rook_attacks_setwise(sliders, empty)
+                              : queen_attacks_setwise(sliders, empty);
+                assert(setwise == expected);
+            }
+        }
+    }
+}
+
 void test_movegen_pawns() {
     fill_attack_sets();
 
@@ -239,6 +429,34 @@ void test_movegen() {
         print_move(move_list_captures[i], &pos_captures);
 }
 
+void test_evasions() {
+    init_LUTs();
+    const char *fens[] = {
+        "4k3/8/8/8/1b6/8/3P4/4K2r w - - 0 1",           //Pinned pawn can't block
+        "4k3/8/8/8/8/5n2/8/r3K3 w - - 0 1",              //Double check
+        "8/8/8/2k5/3Pp3/8/8/4K3 b - d3 0 1",             //En passant captures the checker
+        "r3k2r/p1pPqpb1/bn2pnp1/4N3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R b KQkq - 0 1",
+        "1k6/8/8/8/8/8/4q3/R3K2R w KQ - 0 1"              //No castling out of check
+    };
+    struct Move evasions[256];
+    struct Move all_moves[256];
+    for (size_t i = 0; i < sizeof(fens) / sizeof(fens[0]); ++i) {
+        struct Position pos = pos_from_FEN(fens[i]);
+        assert(pos_in_check(&pos));
+        int num_evasions = generate_evasions(evasions, &pos);
+
+        //The same moves in the same order as generating every move and keeping the legal ones.
+        int num_moves = 0;
+        for (enum Piece_type pt = KNIGHT; pt <= KING; ++pt)
+            num_moves += generate_moves_pt(pt, all_moves + num_moves, &pos);
+        num_moves += generate_pawn_moves(all_moves + num_moves, &pos);
+
+        assert(num_evasions == num_moves);
+        for (int m = 0; m < num_moves; ++m)
+            assert(tt_encode_move(evasions[m]) == tt_encode_move(all_moves[m]));
+    }
+}
+
 void test_in_between_LUT() {
     fill_inbetween_LUT();
 
@@ -321,6 +539,30 @@ static bool bitboard_piece_list_consistent(const struct Position *pos) {
     return true;
 }
 
+void test_attack_info() {
+    init_LUTs();
+    //The rook on h1 checks the king, the bishop on b4 pins the pawn on d2.
+    struct Position pos = pos_from_FEN("4k3/8/8/8/1b6/8/3P4/4K2r w - - 0 1");
+    const struct Attack_info *ai = pos_attack_info(&pos);
+    assert(pos.checkers == set_bit(h1));
+    assert(ai->pinned == set_bit(d2));
+    //The squares behind the king on the checking line are attacked.
+    assert(is_set(d1, ai->attacked[BLACK]) && is_set(a1, ai->attacked[BLACK]));
+    assert(is_set(c3, ai->attacked[WHITE]) && !is_set(d3, ai->attacked[WHITE]));
+
+    //The cache is invalidated by make_move and restored by unmake_move.
+    struct Attack_info before = *ai;
+    MS_Stack *move_state_stk = stk_create(4);
+    struct Move move = create_regular_move(e1, e2);
+    make_move(move, &pos, move_state_stk);
+    assert(!pos.attack_info.valid);
+    assert(pos_attack_info(&pos)->pinned == 0ULL);
+    unmake_move(move, &pos, move_state_stk);
+    assert(pos.attack_info.valid && pos.attack_info.pinned == before.pinned
+           && pos.attack_info.attacked[BLACK] == before.attacked[BLACK]);
+    stk_destroy(move_state_stk);
+}
+
 void test_make_move() {
     MS_Stack *move_state_stk = stk_create(INIT_STACK_SIZE);
     struct Position test_pos = pos_from_FEN("4k3/7p/8/3Pp3/5r2/8/3BQPN1/R3K2R w KQkq - 0 1");
@@ -430,6 +672,171 @@ void test_legal_move_check() {
     assert(!legal(qs_castle, &castling_check, move_state_stk));
 }
 
+//Castling, en passant, promotions and direct, discovered and double checks within two plies.
+static const char *const walk_fens[] = {
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1",
+    "3k4/8/8/8/8/8/8/R3K3 w Q - 0 1",
+    "5k2/8/8/8/8/8/8/4K2R w K - 0 1",
+    "4k3/8/8/3pP3/8/4R3/8/4K3 w - d6 0 1"
+};
+
+//Plays every move and reply from the position through make_and_check, which makes the move and
+//checks the resulting position.
+typedef void (*Move_check)(struct Move move, struct Position *pos, MS_Stack *stack);
+
+static void walk_two_plies(const char *fen, Move_check make_and_check) {
+    struct Move moves[256];
+    struct Move replies[256];
+    MS_Stack *stack = stk_create(INIT_STACK_SIZE);
+    struct Position pos = pos_from_FEN(fen);
+    int num_moves = generate_moves(moves, &pos);
+    for (int m = 0; m < num_moves; ++m) {
+        make_and_check(moves[m], &pos, stack);
+        int num_replies = generate_moves(replies, &pos);
+        for (int r = 0; r < num_replies; ++r) {
+            make_and_check(replies[r], &pos, stack);
+            unmake_move(replies[r], &pos, stack);
+        }
+        unmake_move(moves[m], &pos, stack);
+    }
+    stk_destroy(stack);
+}
+
+static void walk_all_fens(Move_check make_and_check) {
+    for (size_t i = 0; i < sizeof(walk_fens) / sizeof(walk_fens[0]); ++i)
+        walk_two_plies(walk_fens[i], make_and_check);
+}
+
+static void make_and_check_key(struct Move move, struct Position *pos, MS_Stack *stack) {
+    make_move(move, pos, stack);
+    assert(pos->key == compute_key(pos));
+}
+
+void test_zobrist() {
+    init_LUTs();
+    //Reference keys from the Polyglot book format specification.
+    struct Position pos1 = pos_from_FEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    struct Position pos2 = pos_from_FEN("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
+    struct Position pos3 = pos_from_FEN("rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2");
+    struct Position pos4 = pos_from_FEN("rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2");
+    struct Position pos5 = pos_from_FEN("rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3");
+    struct Position pos6 = pos_from_FEN("rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3");
+    struct Position pos7 = pos_from_FEN("rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4");
+    struct Position pos8 = pos_from_FEN("rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3");
+    struct Position pos9 = pos_from_FEN("rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4");
+
+    assert(compute_key(&pos1) == 0x463B96181691FC9CULL);
+    assert(compute_key(&pos2) == 0x823C9B50FD114196ULL);
+    assert(compute_key(&pos3) == 0x0756B94461C50FB0ULL);
+    assert(compute_key(&pos4) == 0x662FAFB965DB29D4ULL);
+    assert(compute_key(&pos5) == 0x22A48B5A8E47FF78ULL);
+    assert(compute_key(&pos6) == 0x652A607CA3F242C1ULL);
+    assert(compute_key(&pos7) == 0x00FDD303C946BDD9ULL);
+    assert(compute_key(&pos8) == 0x3C8123EA7B067637ULL);
+    assert(compute_key(&pos9) == 0x5C3F9B829B279560ULL);
+
+    //The incremental key matches the key computed from scratch after every move.
+    walk_all_fens(make_and_check_key);
+    walk_two_plies("rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3", make_and_check_key);
+}
+
+static void make_and_check_checkers(struct Move move, struct Position *pos, MS_Stack *stack) {
+    make_move(move, pos, stack);
+    assert(pos->checkers == compute_checkers(pos));
+}
+
+void test_checkers() {
+    init_LUTs();
+    walk_all_fens(make_and_check_checkers);
+}
+
+static void make_and_check_gives_check(struct Move move, struct Position *pos, MS_Stack *stack) {
+    bool check = gives_check(move, pos);
+    make_move(move, pos, stack);
+    assert(check == pos_in_check(pos));
+}
+
+void test_gives_check() {
+    init_LUTs();
+    walk_all_fens(make_and_check_gives_check);
+    //Discovered check by en passant along the rank, and a promotion that checks.
+    walk_two_plies("8/8/8/R2pP2k/8/8/8/4K3 w - d6 0 1", make_and_check_gives_check);
+    walk_two_plies("8/1P6/1k6/8/8/8/8/4K3 w - - 0 1", make_and_check_gives_check);
+}
+
+void test_kpk() {
+    init_LUTs();
+    //Not KPK endgames
+    struct Position pos_start = pos_from_FEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    struct Position pos_knight = pos_from_FEN("4k3/8/8/8/8/8/4N3/4K3 w - - 0 1");
+    assert(kpk_probe_position(&pos_start) == KPK_NONE);
+    assert(kpk_probe_position(&pos_knight) == KPK_NONE);
+
+    //Rook pawn with the defending king in the corner
+    struct Position pos_rook_pawn = pos_from_FEN("k7/8/8/8/8/8/P7/K7 w - - 0 1");
+    assert(kpk_probe_position(&pos_rook_pawn) == KPK_DRAW);
+
+    //King on the sixth rank in front of its pawn wins regardless of the side to move
+    struct Position pos_sixth_w = pos_from_FEN("4k3/8/4K3/4P3/8/8/8/8 w - - 0 1");
+    struct Position pos_sixth_b = pos_from_FEN("4k3/8/4K3/4P3/8/8/8/8 b - - 0 1");
+    assert(kpk_probe_position(&pos_sixth_w) == KPK_WIN);
+    assert(kpk_probe_position(&pos_sixth_b) == KPK_WIN);
+
+    //Stalemate with black to move, win with white to move
+    struct Position pos_stalemate = pos_from_FEN("4k3/4P3/4K3/8/8/8/8/8 b - - 0 1");
+    struct Position pos_seventh = pos_from_FEN("4k3/4P3/4K3/8/8/8/8/8 w - - 0 1");
+    assert(kpk_probe_position(&pos_stalemate) == KPK_DRAW);
+    assert(kpk_probe_position(&pos_seventh) == KPK_WIN);
+
+    //The same positions with colors reversed and mirrored files
+    struct Position pos_black_pawn = pos_from_FEN("8/8/8/8/3p4/3k4/8/3K4 w - - 0 1");
+    struct Position pos_black_corner = pos_from_FEN("7k/7p/8/8/8/8/8/7K b - - 0 1");
+    assert(kpk_probe_position(&pos_black_pawn) == KPK_WIN);
+    assert(kpk_probe_position(&pos_black_corner) == KPK_DRAW);
+
+    //Opposition: the defending king in front of the pawn with the attacker to move draws
+    struct Position pos_opposition = pos_from_FEN("8/8/8/4k3/8/4K3/4P3/8 w - - 0 1");
+    assert(kpk_probe_position(&pos_opposition) == KPK_DRAW);
+}
+
+void test_tablebase_index() {
+    init_LUTs();
+    struct Tb_material mat;
+    assert(tb_material_from_name("KQvKR", &mat));
+    assert(mat.num_pieces == 4 && !mat.has_pawns);
+    assert(tb_material_from_name("KPvK", &mat) && mat.has_pawns);
+    //Weaker side first, pieces out of order, or too many pieces
+    assert(!tb_material_from_name("KvKQ", &mat));
+    assert(!tb_material_from_name("KRQvK", &mat));
+    assert(!tb_material_from_name("KQRvKP", &mat));
+
+    struct Tb_material mats[64];
+    assert(tb_all_materials(mats, 64, 3) == 5);
+    assert(tb_all_materials(mats, 64, 4) == 35);
+
+    //Every valid index maps to a position that maps back to the same index.
+    const char *names[] = { "KPvK", "KRRvK", "KNvKP" };
+    for (int i = 0; i < 3; ++i) {
+        assert(tb_material_from_name(names[i], &mat));
+        for (u64 idx = 0; idx < tb_table_size(&mat); idx += 97) {
+            struct Position pos;
+            if (tb_index_to_position(&mat, idx, &pos))
+                assert(tb_position_to_index(&mat, &pos, false) == idx);
+        }
+    }
+
+    //Reflected and color flipped versions of a position share an index.
+    assert(tb_material_from_name("KQvKR", &mat));
+    struct Position pos = pos_from_FEN("8/8/8/3k4/8/8/8/KQ2r3 w - - 0 1");
+    struct Position mirrored = pos_from_FEN("8/8/8/4k3/8/8/8/3r2QK w - - 0 1");
+    struct Position flipped = pos_from_FEN("kq2R3/8/8/8/3K4/8/8/8 b - - 0 1");
+    u64 idx = tb_position_to_index(&mat, &pos, false);
+    assert(tb_position_to_index(&mat, &mirrored, false) == idx);
+    assert(tb_position_to_index(&mat, &flipped, true) == idx);
+}
+
 void run_perft_tests(int depth_max) {
     init_LUTs();
     struct Position starting_pos = pos_from_FEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
@@ -518,3 +925,151 @@ uint64_t perft(struct Position* pos, int depth, MS_Stack *move_state_stk, struct
     return nodes;
 }
 
+void test_evaluate_position() {
+    init_LUTs();
+    const char *fens[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R b KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "4k3/8/8/8/8/8/8/R3K3 w Q - 0 1"
+    };
+
+    //Arbitrary parameters, so that every table entry counts.
+    int saved_params[NUM_EVAL_PARAMS];
+    memcpy(saved_params, eval_params, sizeof(saved_params));
+    for (int p = 0; p < NUM_EVAL_PARAMS; ++p)
+        eval_params[p] = (p * 37) % 101 - 50;
+
+    for (int i = 0; i < 4; ++i) {
+        struct Position pos = pos_from_FEN(fens[i]);
+        struct Eval_term terms[MAX_EVAL_TERMS];
+        int num_terms = eval_terms(&pos, terms);
+        int sum = 0;
+        for (int t = 0; t < num_terms; ++t)
+            sum += terms[t].coeff * eval_params[terms[t].param];
+        assert(sum == evaluate_position(&pos, WHITE));
+        assert(sum == -evaluate_position(&pos, BLACK));
+    }
+
+    memcpy(eval_params, saved_params, sizeof(saved_params));
+}
+
+//Searches the position with the given keys of the game positions before it.
+static int search_with_history(const char *fen, int depth, const u64 *keys, int num_keys) {
+    struct Position pos = pos_from_FEN(fen);
+    struct Search_info si;
+    search_info_init(&si, (struct Search_limits) {.depth = depth});
+    search_info_set_history(&si, keys, num_keys);
+    si.silent = true;
+    struct Move best_move;
+    int score = negamax_root(&si, &pos, depth, &best_move);
+    search_info_destroy(&si);
+    return score;
+}
+
+static int search_to_depth(const char *fen, int depth) {
+    return search_with_history(fen, depth, NULL, 0);
+}
+
+void test_mate_scores() {
+    init_LUTs();
+    //Checkmated and stalemated at the root
+    assert(search_to_depth("R5k1/5ppp/8/8/8/8/8/6K1 b - - 0 1", 1) == -MATE_SCORE);
+    assert(search_to_depth("7k/5Q2/6K1/8/8/8/6PP/8 b - - 0 1", 1) == 0);
+    //Mate in one is found at any depth, and preferred over longer mates
+    assert(search_to_depth("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1", 2) == MATE_SCORE - 1);
+    assert(search_to_depth("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1", 4) == MATE_SCORE - 1);
+}
+
+void test_draws() {
+    init_LUTs();
+    //Down two queens, white only holds with the perpetual Qe8+ Kh7 Qh5+ Kg8, which repeats inside the
+    //search after five plies.
+    const char *perpetual = "6k1/6p1/8/7Q/8/7K/8/qq6 w - - 10 40";
+    assert(search_to_depth(perpetual, 5) == 0);
+
+    //At depth 1 the position after Qe8+ is only a draw if it occurred twice before the root.
+    struct Position pos = pos_from_FEN(perpetual);
+    MS_Stack *stack = stk_create(4);
+    make_move(create_regular_move(h5, e8), &pos, stack);
+    stk_destroy(stack);
+    u64 keys[6] = {0};
+    keys[3] = pos.key;
+    assert(search_with_history(perpetual, 1, keys, 6) < 0);
+    keys[1] = pos.key;
+    assert(search_with_history(perpetual, 1, keys, 6) == 0);
+
+    //Every move reaches the fifty-move limit, which is a draw unless the move mates.
+    assert(search_to_depth("6k1/8/8/8/8/8/8/Q5K1 w - - 99 60", 2) == 0);
+    assert(search_to_depth("6k1/5ppp/8/8/8/8/8/R5K1 w - - 99 60", 2) == MATE_SCORE - 1);
+}
+
+void test_tt() {
+    init_LUTs();
+    struct Tt tt = {0};
+    assert(tt_resize(&tt, 1, 1));
+    assert(tt.size <= 1024 * 1024 && (tt.mask + 1) * sizeof(struct Tt_entry) == tt.size);
+
+    //Every move survives the encoding, including castling, en passant and promotions.
+    struct Position pos = pos_from_FEN("r3k2r/1P6/8/3pP3/8/8/8/R3K2R w KQkq d6 0 1");
+    struct Move move_list[256];
+    int num_moves = generate_moves(move_list, &pos);
+    for (int i = 0; i < num_moves; ++i) {
+        assert(tt_encode_move(move_list[i]) != TT_NO_MOVE);
+        struct Move m = tt_decode_move(tt_encode_move(move_list[i]));
+        assert(m.from_sq == move_list[i].from_sq && m.to_sq == move_list[i].to_sq);
+        assert(m.promotion_type == move_list[i].promotion_type);
+        assert(m.en_passant == move_list[i].en_passant && m.castling == move_list[i].castling);
+    }
+
+    struct Tt_entry entry;
+    assert(!tt_probe(&tt, pos.key, &entry));
+    tt_store(&tt, pos.key, 5, -123, TT_LOWER, tt_encode_move(move_list[0]));
+    assert(tt_probe(&tt, pos.key, &entry));
+    assert(entry.depth == 5 && entry.score == -123 && entry.bound == TT_LOWER);
+    assert(entry.move == tt_encode_move(move_list[0]));
+    //A different key that maps to the same slot doesn't match.
+    assert(!tt_probe(&tt, pos.key ^ ((tt.mask + 1) << 1), &entry));
+
+    //Shallower bounds don't replace a deeper entry, and a store without a move keeps the old one.
+    tt_store(&tt, pos.key, 3, 50, TT_UPPER, TT_NO_MOVE);
+    assert(tt_probe(&tt, pos.key, &entry) && entry.depth == 5 && entry.score == -123);
+    tt_store(&tt, pos.key, 6, 50, TT_UPPER, TT_NO_MOVE);
+    assert(tt_probe(&tt, pos.key, &entry) && entry.depth == 6 && entry.score == 50);
+    assert(entry.move == tt_encode_move(move_list[0]));
+
+    //Only entries of the current search count towards hashfull.
+    for (u64 i = 0; i < 500; ++i)
+        tt_store(&tt, i, 1, 0, TT_EXACT, TT_NO_MOVE);
+    assert(tt_hashfull(&tt) == 500);
+    tt_new_search(&tt);
+    assert(tt_hashfull(&tt) == 0);
+
+    tt_clear(&tt, 2);
+    assert(!tt_probe(&tt, pos.key, &entry));
+    tt_free(&tt);
+}
+
+void test_root_moves() {
+    init_LUTs();
+    struct Position pos = pos_from_FEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    struct Search_info *si = malloc(sizeof(struct Search_info));
+    search_info_init(si, (struct Search_limits) {.depth = 3, .multipv = 4});
+    si->silent = true;
+    struct Move best_move;
+    int score = search(&pos, si, &best_move);
+
+    //Every legal move is scored, best first, and the first line is the one that is played.
+    struct Move move_list[256];
+    assert(si->num_root_moves == generate_moves(move_list, &pos));
+    assert(si->root_moves[0].score == score);
+    assert(tt_encode_move(si->root_moves[0].move) == tt_encode_move(best_move));
+    for (int i = 0; i < si->num_root_moves; ++i) {
+        assert(si->root_moves[i].pv_length >= 1);
+        assert(tt_encode_move(si->root_moves[i].pv[0]) == tt_encode_move(si->root_moves[i].move));
+        if (i > 0)
+            assert(si->root_moves[i - 1].score >= si->root_moves[i].score);
+    }
+    search_info_destroy(si);
+    free(si);
+}
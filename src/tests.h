@@ -8,20 +8,34 @@ struct Position;
 void run_all_tests(void);
 
 void test_FEN(void);
+void test_fen_parse(void);
+void test_packed_position(void);
 void test_bitshifts(void);
 void test_attack_sets(void);
 void test_ray_attacks(void);
 void test_attacks_from(void);
+void test_setwise_attacks(void);
 void test_movegen_pawns(void);
 void test_movegen(void);
+void test_evasions(void);
 void test_castling_rights(void);
 void test_in_between_LUT(void);
 void test_attackers_to(void);
+void test_attack_info(void);
 void test_make_move(void);
 void test_stack(void);
 void test_legal_move_check(void);
+void test_zobrist(void);
+void test_checkers(void);
+void test_gives_check(void);
+void test_kpk(void);
+void test_tablebase_index(void);
 void run_perft_tests(int depth_max);
 void test_evaluate_position(void);
+void test_mate_scores(void);
+void test_draws(void);
+void test_tt(void);
+void test_root_moves(void);
 
 struct Perft_counts {
     int checkmates;
@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "tt.h"
+
+#define HUGE_PAGE_SZ (2 * 1024 * 1024)
+//Clearing less than this per thread isn't worth starting a thread for.
+#define MIN_CLEAR_SZ (32 * 1024 * 1024)
+#define HASHFULL_SAMPLE 1000
+
+_Static_assert(sizeof(struct Tt_entry) == 16, "Tt_entry must be 16 bytes");
+
+struct Clear_args {
+    unsigned char *begin;
+    size_t len;
+};
+
+static void *clear_worker(void *arg) {
+    struct Clear_args *args = arg;
+    memset(args->begin, 0, args->len);
+    return NULL;
+}
+
+void tt_clear(struct Tt *tt, int num_threads) {
+    if (tt->entries == NULL)
+        return;
+    if (num_threads <= 0)
+        num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if ((size_t) num_threads > tt->size / MIN_CLEAR_SZ)
+        num_threads = (int) (tt->size / MIN_CLEAR_SZ);
+    if (num_threads <= 1) {
+        memset(tt->entries, 0, tt->size);
+        return;
+    }
+
+    //The first touch of a page faults it in, so a fresh table is mapped by all threads at once.
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    struct Clear_args *args = malloc(num_threads * sizeof(struct Clear_args));
+    size_t chunk = tt->size / num_threads;
+    int num_started = 0;
+    for (int i = 0; i < num_threads; ++i) {
+        args[i].begin = (unsigned char*) tt->entries + i * chunk;
+        args[i].len = (i == num_threads - 1) ? tt->size - i * chunk : chunk;
+        if (pthread_create(&threads[num_started], NULL, clear_worker, &args[i]) == 0)
+            ++num_started;
+        else
+            clear_worker(&args[i]);
+    }
+    for (int i = 0; i < num_started; ++i)
+        pthread_join(threads[i], NULL);
+    free(args);
+    free(threads);
+}
+
+bool tt_resize(struct Tt *tt, size_t mb, int num_threads) {
+    if (mb < 1)
+        mb = 1;
+    if (mb > TT_MAX_MB)
+        mb = TT_MAX_MB;
+
+    u64 num_entries = 1;
+    while (num_entries * 2 * sizeof(struct Tt_entry) <= mb * 1024 * 1024)
+        num_entries *= 2;
+    size_t size = num_entries * sizeof(struct Tt_entry);
+
+    //aligned_alloc needs the size to be a multiple of the alignment.
+    size_t alloc_size = (size + HUGE_PAGE_SZ - 1) / HUGE_PAGE_SZ * HUGE_PAGE_SZ;
+    struct Tt_entry *entries = aligned_alloc(HUGE_PAGE_SZ, alloc_size);
+    if (entries == NULL)
+        return false;
+#ifdef MADV_HUGEPAGE
+    madvise(entries, alloc_size, MADV_HUGEPAGE);
+#endif
+
+    tt_free(tt);
+    tt->entries = entries;
+    tt->mask = num_entries - 1;
+    tt->size = size;
+    tt_clear(tt, num_threads);
+    return true;
+}
+
+void tt_free(struct Tt *tt) {
+    free(tt->entries);
+    tt->entries = NULL;
+    tt->mask = 0;
+    tt->size = 0;
+    tt->generation = 0;
+}
+
+void tt_new_search(struct Tt *tt) {
+    tt->generation = (tt->generation + 1) & 63;
+}
+
+int tt_hashfull(const struct Tt *tt) {
+    if (tt->entries == NULL)
+        return 0;
+    u64 num_samples = tt->mask + 1 < HASHFULL_SAMPLE ? tt->mask + 1 : HASHFULL_SAMPLE;
+    u64 used = 0;
+    for (u64 i = 0; i < num_samples; ++i)
+        used += tt->entries[i].bound != TT_NONE && tt->entries[i].generation == tt->generation;
+    return (int) (used * 1000 / num_samples);
+}
+
+bool tt_probe(const struct Tt *tt, u64 key, struct Tt_entry *entry) {
+    const struct Tt_entry *slot = &tt->entries[key & tt->mask];
+    if (slot->bound == TT_NONE || slot->key != key)
+        return false;
+    *entry = *slot;
+    return true;
+}
+
+//Entries from a deeper search of the same position are kept, everything else is replaced.
+//A search that found no best move keeps the move of a previous search of the position.
+void tt_store(struct Tt *tt, u64 key, int depth, int score, enum Tt_bound bound, uint32_t move) {
+    struct Tt_entry *slot = &tt->entries[key & tt->mask];
+    if (slot->key == key && slot->depth > depth && bound != TT_EXACT)
+        return;
+    if (move != TT_NO_MOVE || slot->key != key)
+        slot->move = move;
+    slot->key = key;
+    slot->score = (int16_t) score;
+    slot->depth = (uint8_t) depth;
+    slot->bound = bound;
+    slot->generation = tt->generation;
+}
+
+//from (6 bits), to (6 bits), promotion type (3 bits), en passant and castling flags.
+uint32_t tt_encode_move(struct Move move) {
+    return (uint32_t) move.from_sq | (uint32_t) move.to_sq << 6 | (uint32_t) move.promotion_type << 12
+           | (uint32_t) move.en_passant << 15 | (uint32_t) move.castling << 16;
+}
+
+struct Move tt_decode_move(uint32_t move) {
+    struct Move m;
+    m.from_sq = (enum Square) (move & 63);
+    m.to_sq = (enum Square) (move >> 6 & 63);
+    m.promotion_type = (enum Piece_type) (move >> 12 & 7);
+    m.en_passant = move >> 15 & 1;
+    m.castling = move >> 16 & 1;
+    return m;
+}
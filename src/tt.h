@@ -0,0 +1,76 @@
+#ifndef TT_H
+#define TT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "position.h"
+#include "types.h"
+
+#define TT_DEFAULT_MB 16
+#define TT_MAX_MB 131072
+
+enum Tt_bound {
+    TT_NONE,
+    TT_UPPER, //The score is at most the stored score (fail low)
+    TT_LOWER, //The score is at least the stored score (fail high)
+    TT_EXACT
+};
+
+//16 bytes, so that four entries share a cache line.
+struct Tt_entry {
+    u64 key;
+    uint32_t move;
+    int16_t score;
+    uint8_t depth;
+    unsigned bound : 2;
+    unsigned generation : 6; //Search that stored the entry
+};
+
+//Transposition table with one entry per slot, indexed by the low bits of the key.
+struct Tt {
+    struct Tt_entry *entries;
+    u64 mask;
+    size_t size; //In bytes
+    uint8_t generation; //Incremented by every search, wraps around at 64
+};
+
+/*
+    Allocates a table of at most mb megabytes, rounded down to a power of two number of entries.
+    The memory is aligned to 2MB and backed by transparent huge pages where the kernel supports them,
+    so that probes into a large table don't miss the TLB on every access. The pages are faulted in by
+    num_threads threads (all cores if <= 0) while clearing the table. On failure the previous table is kept.
+*/
+bool tt_resize(struct Tt *tt, size_t mb, int num_threads);
+void tt_free(struct Tt *tt);
+
+//Empties the table, splitting the work between num_threads threads (all cores if <= 0).
+void tt_clear(struct Tt *tt, int num_threads);
+
+//Starts loading the slot of key into the cache, so that a later probe doesn't wait for memory.
+static inline void tt_prefetch(const struct Tt *tt, u64 key) {
+#if defined(__GNUC__)
+    __builtin_prefetch(&tt->entries[key & tt->mask]);
+#else
+    (void) tt;
+    (void) key;
+#endif
+}
+
+//Starts a new search, so that entries stored from now on can be told apart from older ones.
+void tt_new_search(struct Tt *tt);
+
+//Permille of the table used by the current search, estimated from the first 1000 slots.
+int tt_hashfull(const struct Tt *tt);
+
+//Copies the entry for key into entry and returns true if there is one.
+bool tt_probe(const struct Tt *tt, u64 key, struct Tt_entry *entry);
+void tt_store(struct Tt *tt, u64 key, int depth, int score, enum Tt_bound bound, uint32_t move);
+
+//Moves are stored in 32 bits. TT_NO_MOVE (a1a1) is never a legal move.
+#define TT_NO_MOVE 0
+uint32_t tt_encode_move(struct Move move);
+struct Move tt_decode_move(uint32_t move);
+
+#endif
@@ -1,39 +1,124 @@
-#include <assert.h>
-#include <ctype.h>
+#define _POSIX_C_SOURCE 200809L
+
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "bench.h"
 #include "bitboard.h"
+#include "book.h"
+#include "fen.h"
+#include "movegen.h"
 #include "position.h"
 #include "search.h"
+#include "tablebase.h"
 #include "tables.h"
+#include "tt.h"
 #include "uci.h"
 
-#define BUFF_SZ 256
-#define TOKEN_BUFF_SZ 50
+//Longest value of a string option, such as a path.
+#define OPTION_STR_SZ 4096
+#define MAX_NUM_MOVES 256
+#define MAX_MULTIPV 256
+
+//Depth searched by a go command without any limits.
+#define DEFAULT_DEPTH 6
+
+//Time management: without movestogo, the remaining time is assumed to last this many moves.
+#define DEFAULT_MOVES_TO_GO 30
+//Time kept in reserve for communication overhead, in milliseconds.
+#define MOVE_OVERHEAD_MS 30
+
+struct Uci_options {
+    int hash_mb;
+    //Number of best lines reported by the search.
+    int multipv;
+    char book_file[OPTION_STR_SZ];
+    char tablebase_path[OPTION_STR_SZ];
+    //Book moves are only played up to this fullmove number.
+    int book_depth;
+    //Play the book move with the highest weight instead of a weighted random one.
+    bool book_best_move;
+};
 
-struct SearchOptions {
-    int depth;
-    unsigned long movetime;
-    bool infinite;
+static struct Uci_options options = {
+    .hash_mb = TT_DEFAULT_MB,
+    .multipv = 1,
+    .book_file = "",
+    .tablebase_path = "",
+    .book_depth = 20,
+    .book_best_move = false
 };
 
+//Shared by all searches of the game, cleared by ucinewgame.
+static struct Tt tt = {0};
+
+//Keys of the positions of the game before the current one, since the last irreversible move.
+static u64 game_keys[MAX_GAME_HISTORY];
+static int num_game_keys = 0;
+
+/*
+    The game set up by the position commands: how it started (the "startpos" token or the text of the
+    FEN) and the moves played since, as they were sent. GUIs send the whole game before every move,
+    so a command that extends the game only has to apply the new moves.
+*/
+struct Uci_game {
+    char *start;
+    size_t start_len;
+    size_t start_cap;
+    char (*moves)[6];
+    int num_moves;
+    int moves_cap;
+};
+
+static struct Uci_game game = { NULL, 0, 0, NULL, 0, 0 };
+
 static const char *startpos_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
-static const char *separator = " \n\t";
 
-static enum Square sq_from_str(const char *sq_str) {
-    assert(strlen(sq_str) == 2);
-    assert(isalpha(sq_str[0]) && isdigit(sq_str[1]));
-    enum File file = (enum File) (sq_str[0] - 'a');
-    enum Rank rank = (enum Rank) (sq_str[1] - '0' - 1);
+/*
+    Commands are split into tokens in place: a token points into the line, nothing is copied or
+    modified, and all of the state is in the Tokenizer so parsers can be nested.
+*/
+struct Tokenizer {
+    const char *cur;
+    const char *end;
+};
+
+struct Token {
+    const char *str;
+    size_t len;
+};
 
-    return file_rank_sq(file, rank);
+static inline bool is_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+//Returns false if there are no tokens left.
+static bool next_token(struct Tokenizer *tk, struct Token *token) {
+    const char *p = tk->cur;
+    while (p < tk->end && is_separator(*p))
+        ++p;
+    const char *begin = p;
+    while (p < tk->end && !is_separator(*p))
+        ++p;
+    tk->cur = p;
+    token->str = begin;
+    token->len = (size_t) (p - begin);
+    return token->len > 0;
+}
+
+static bool token_eq(struct Token token, const char *str) {
+    size_t len = strlen(str);
+    return token.len == len && memcmp(token.str, str, len) == 0;
+}
+
+//The number at the start of the token. The line is NUL-terminated, so strtoll stops at the end of the token.
+static long long token_to_ll(struct Token token) {
+    return strtoll(token.str, NULL, 10);
 }
 
 static enum Piece_type piece_from_promotion_char(char c) {
-    c = tolower(c);
     switch (c) {
         case 'n':
             return KNIGHT;
@@ -48,167 +133,485 @@ static enum Piece_type piece_from_promotion_char(char c) {
     }
 }
 
-static struct Move token_to_move(const char *token, const struct Position *pos) {
-    assert(strlen(token) == 4 || strlen(token) == 5);
-    char from_sq_str[3];
-    from_sq_str[0] = token[0];
-    from_sq_str[1] = token[1];
-    from_sq_str[2] = '\0';
-
-    char to_sq_str[3];
-    to_sq_str[0] = token[2];
-    to_sq_str[1] = token[3];
-    to_sq_str[2] = '\0';
-
-    enum Square from_sq = sq_from_str(&from_sq_str[0]);
-    enum Square to_sq = sq_from_str(&to_sq_str[0]);
-
-    enum Piece_type moved_pt = to_piece_type(pos->piece_list[from_sq]);
-
-    struct Move move = create_regular_move(from_sq, to_sq);
-
-    if (moved_pt == KING && (from_sq - to_sq) == 2)
-        move.castling = true;
+/*
+    Finds the legal move given in long algebraic notation, e.g. e2e4, or e7e8q for a promotion.
+    Matching against the generated moves sets the castling and en passant flags, and rejects illegal
+    or malformed moves. Returns false in that case.
+*/
+static bool token_to_move(struct Token token, struct Position *pos, struct Move *move) {
+    if (token.len != 4 && token.len != 5)
+        return false;
+    const char *s = token.str;
+    for (int i = 0; i < 4; i += 2) {
+        if (s[i] < 'a' || s[i] > 'h' || s[i + 1] < '1' || s[i + 1] > '8')
+            return false;
+    }
+    enum Square from_sq = file_rank_sq((enum File) (s[0] - 'a'), (enum Rank) (s[1] - '1'));
+    enum Square to_sq = file_rank_sq((enum File) (s[2] - 'a'), (enum Rank) (s[3] - '1'));
+    enum Piece_type promotion_type = (token.len == 5) ? piece_from_promotion_char(s[4]) : PT_NULL;
+    if (token.len == 5 && promotion_type == PT_NULL)
+        return false;
+
+    struct Move move_list[MAX_NUM_MOVES];
+    int num_moves = generate_moves(move_list, pos);
+    for (int i = 0; i < num_moves; ++i) {
+        if (move_list[i].from_sq == from_sq && move_list[i].to_sq == to_sq
+            && move_list[i].promotion_type == promotion_type) {
+            *move = move_list[i];
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (strlen(token) == 5)
-        move.promotion_type = piece_from_promotion_char(token[4]);
+static void push_game_key(u64 key) {
+    if (num_game_keys == MAX_GAME_HISTORY) {
+        memmove(game_keys, game_keys + 1, (MAX_GAME_HISTORY - 1) * sizeof(u64));
+        --num_game_keys;
+    }
+    game_keys[num_game_keys++] = key;
+}
 
-    enum Side us = piece_color(pos->piece_list[move.from_sq]);
-    if (moved_pt == PAWN && to_sq == pos->ep_square && (attack_set.pawn[us][from_sq] & set_bit(to_sq)))
-        move.en_passant = true;
+static void game_set_start(struct Token start) {
+    if (start.len > game.start_cap) {
+        game.start_cap = start.len;
+        game.start = realloc(game.start, game.start_cap);
+    }
+    memcpy(game.start, start.str, start.len);
+    game.start_len = start.len;
+    game.num_moves = 0;
+}
 
-    return move;
+static void game_push_move(struct Token move) {
+    if (game.num_moves == game.moves_cap) {
+        game.moves_cap = game.moves_cap ? 2 * game.moves_cap : 256;
+        game.moves = realloc(game.moves, game.moves_cap * sizeof(*game.moves));
+    }
+    //token_to_move only accepts moves of 4 or 5 characters.
+    memcpy(game.moves[game.num_moves], move.str, move.len);
+    game.moves[game.num_moves][move.len] = '\0';
+    ++game.num_moves;
 }
 
-static void uci_position(struct Position *pos, const char *command_str) {
-    char *token = strtok(NULL, separator);
-    if (strncmp(token, "startpos", 9) == 0) {
-        *pos = pos_from_FEN(startpos_FEN);
-        token = strtok(NULL, separator); //Consume potential "moves" token, or NULL if no such token exists.
-    } else if (strncmp(token, "fen", 4) == 0) {
-        unsigned buff_sz_left = BUFF_SZ - 1;
-        char fen_string_buff[BUFF_SZ];
-        char *buff_ptr = &fen_string_buff[0];
-        unsigned token_len = 0;
-        while (strncmp(token, "moves", 6) && token != NULL) {
-            token = strtok(NULL, separator);
-            strncpy(buff_ptr, token, buff_sz_left);
+static void uci_position(struct Position *pos, struct Tokenizer *tk) {
+    struct Token token;
+    if (!next_token(tk, &token))
+        return;
 
-            token_len = strlen(token);
-            buff_ptr += token_len;
-            buff_sz_left -= token_len;
+    struct Token start = token;
+    struct Position new_pos;
+    if (token_eq(token, "fen")) {
+        //The FEN is parsed straight from the line, and the tokenizer continues after it.
+        const char *next;
+        enum Fen_error err = fen_parse(tk->cur, tk->end, &new_pos, &next);
+        if (err != FEN_OK) {
+            printf("info string invalid FEN: %s\n", fen_error_str(err));
+            return;
         }
-
-        *(buff_ptr + 1) = '\0';
-        *pos = pos_from_FEN(fen_string_buff);
-    } else {
-        assert(false);
+        start.str = tk->cur;
+        while (start.str < next && is_separator(*start.str))
+            ++start.str;
+        start.len = (size_t) (next - start.str);
+        tk->cur = next;
+    } else if (!token_eq(token, "startpos")) {
+        return;
     }
 
-    if (token == NULL || strncmp(token, "moves", 6) != 0)
-        return;
+    bool has_moves = next_token(tk, &token) && token_eq(token, "moves");
+    if (!has_moves)
+        tk->cur = tk->end;
+
+    //The command extends the game if it has the same start and begins with all the moves played so far.
+    struct Tokenizer moves_tk = *tk;
+    bool extends = start.len == game.start_len && memcmp(start.str, game.start, start.len) == 0;
+    for (int i = 0; extends && i < game.num_moves; ++i)
+        extends = next_token(&moves_tk, &token) && token_eq(token, game.moves[i]);
+
+    if (!extends) {
+        if (token_eq(start, "startpos"))
+            new_pos = pos_from_FEN(startpos_FEN);
+        *pos = new_pos;
+        num_game_keys = 0;
+        game_set_start(start);
+        moves_tk = *tk;
+    }
 
-    //Apply moves to the position.
-    while (token != NULL) {
-        //Moves are encoded in long algebraic notation, e.g. e2e4
-        //In case of promotion, the promotion piece is given in the end, e.g. e7e8q.
-        token = strtok(NULL, separator);
-        if (token == NULL)
+    while (next_token(&moves_tk, &token)) {
+        struct Move m;
+        if (!token_to_move(token, pos, &m)) {
+            printf("info string illegal move %.*s\n", (int) token.len, token.str);
             break;
-        size_t token_len = strlen(token);
-        assert(token_len == 4|| token_len == 5);
-        struct Move m = token_to_move(token, pos);
+        }
+        game_push_move(token);
+        push_game_key(pos->key);
         make_move(m, pos, NULL);
+        //Positions before a capture or pawn move can't occur again.
+        if (pos->half_move_clock == 0)
+            num_game_keys = 0;
     }
-    print_position(pos);
 }
 
-static void uci_go(struct Position *pos) {
-    //TODO: Add proper handling of options
-    struct SearchOptions opts = {
-        .depth = 6,
+//Time for a move with a clock: an equal share of the remaining time plus most of the increment,
+//never using more than the remaining time minus the move overhead.
+static unsigned long allocate_time(long remaining, long increment, long moves_to_go) {
+    long budget = remaining / (moves_to_go > 0 ? moves_to_go : DEFAULT_MOVES_TO_GO) + increment * 3 / 4;
+    long max_time = remaining - MOVE_OVERHEAD_MS;
+    if (budget > max_time)
+        budget = max_time;
+    return budget > 1 ? (unsigned long) budget : 1;
+}
+
+//Parses the arguments of the go command, the "go" token itself has already been consumed.
+static struct Search_limits parse_go_limits(const struct Position *pos, struct Tokenizer *tk,
+                                            bool *infinite_out, bool *ponder_out) {
+    struct Search_limits limits = {
+        .depth = 0,
         .movetime = 0,
-        .infinite = false
+        .nodes = 0
     };
+    bool infinite = false;
+    bool ponder = false;
+    long time[2] = { -1, -1 };
+    long increment[2] = { 0, 0 };
+    long moves_to_go = 0;
+
+    struct Token token;
+    struct Token value;
+    while (next_token(tk, &token)) {
+        if (token_eq(token, "infinite")) {
+            infinite = true;
+        } else if (token_eq(token, "ponder")) {
+            ponder = true;
+        } else if (!next_token(tk, &value)) {
+            //All other arguments have a value.
+            break;
+        } else if (token_eq(token, "movetime")) {
+            limits.movetime = (unsigned long) token_to_ll(value);
+        } else if (token_eq(token, "depth")) {
+            limits.depth = (int) token_to_ll(value);
+        } else if (token_eq(token, "nodes")) {
+            limits.nodes = (u64) token_to_ll(value);
+        } else if (token_eq(token, "wtime")) {
+            time[WHITE] = (long) token_to_ll(value);
+        } else if (token_eq(token, "btime")) {
+            time[BLACK] = (long) token_to_ll(value);
+        } else if (token_eq(token, "winc")) {
+            increment[WHITE] = (long) token_to_ll(value);
+        } else if (token_eq(token, "binc")) {
+            increment[BLACK] = (long) token_to_ll(value);
+        } else if (token_eq(token, "movestogo")) {
+            moves_to_go = (long) token_to_ll(value);
+        }
+    }
 
-    struct Move best_move;
-    int score = negamax_root(pos, opts.depth, &best_move);
-    printf("bestmove ");
-    print_move(best_move, pos);
+    enum Side us = pos->side_to_move;
+    if (!infinite && limits.movetime == 0 && time[us] >= 0)
+        limits.movetime = allocate_time(time[us], increment[us], moves_to_go);
+
+    if (!infinite && limits.depth == 0 && limits.movetime == 0 && limits.nodes == 0)
+        limits.depth = DEFAULT_DEPTH;
+
+    *infinite_out = infinite;
+    *ponder_out = ponder;
+    return limits;
 }
 
-//Wrapper around uci_go that takes a void* as argument, which is the
-//pthreads handles function args.
-static void* uci_go_pthreads_wrap(void* pos) {
-    uci_go((struct Position*) pos);
+#ifdef SEARCH_STATS
+//Statistics accumulated over all searches since the last ucinewgame.
+static struct Search_stats accumulated_stats;
+#endif
+
+/*
+    The search runs in its own thread, so that stop and ponderhit can be handled while it is running.
+    The thread sends bestmove itself. An infinite or pondering search that finishes early waits for
+    stop or ponderhit before sending it, as the protocol requires.
+*/
+struct Search_thread {
+    pthread_t thread;
+    bool running;
+    bool infinite;
+
+    struct Position pos;
+    struct Search_info *si;
+
+    //Wakes up a finished search that waits for stop or ponderhit.
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static struct Search_thread search_thread = {
+    .running = false,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+static void *search_thread_main(void *arg) {
+    struct Search_thread *st = arg;
+    struct Search_info *si = st->si;
+
+    struct Move best_move;
+    search(&st->pos, si, &best_move);
+#ifdef SEARCH_STATS
+    search_stats_add(&accumulated_stats, &si->stats);
+#endif
+
+    pthread_mutex_lock(&st->lock);
+    while ((st->infinite || si->ponder) && !si->stop)
+        pthread_cond_wait(&st->cond, &st->lock);
+    pthread_mutex_unlock(&st->lock);
+
+    //The null move is sent when there is no legal move to play. The expected reply is the
+    //second move of the principal variation.
+    char move_str[6];
+    char ponder_str[6];
+    if (si->root_pv_length == 0) {
+        puts("bestmove 0000");
+    } else if (si->root_pv_length == 1) {
+        move_to_str(best_move, move_str);
+        printf("bestmove %s\n", move_str);
+    } else {
+        move_to_str(best_move, move_str);
+        move_to_str(si->root_pv[1], ponder_str);
+        printf("bestmove %s ponder %s\n", move_str, ponder_str);
+    }
     return NULL;
 }
 
-static void run_search(struct Position *pos, char *command_str) {
-    struct SearchOptions opts = {
-        .depth = 10,
-        .movetime = 0,
-        .infinite = false
-    };
+//Blocks until the running search, if any, has sent bestmove.
+static void wait_for_search(void) {
+    if (!search_thread.running)
+        return;
+    pthread_join(search_thread.thread, NULL);
+    search_info_destroy(search_thread.si);
+    free(search_thread.si);
+    search_thread.si = NULL;
+    search_thread.running = false;
+}
 
-    char *token = strtok(NULL, separator);
-    while (token != NULL) {
-        if (strncmp(token, "infinite", 9) == 0) {
-            opts.infinite = true;
-        } else if (strncmp(token, "movetime", 9) == 0) {
-            char *move_time = strtok(NULL, separator);
-            assert(move_time != NULL);
-            unsigned long time = strtoul(move_time, NULL, 10);
-            assert(time != 0);
-            opts.movetime = time;
-        } else if (strncmp(token, "depth", 6) == 0) {
-            char *depth_str = strtok(NULL, separator);
-            assert(depth_str != NULL);
-            unsigned long depth = strtoul(depth_str, NULL, 10);
-            assert(depth != 0);
-            opts.depth = depth;
-        }
+static void uci_stop(void) {
+    if (!search_thread.running)
+        return;
+    pthread_mutex_lock(&search_thread.lock);
+    search_thread.si->stop = true;
+    pthread_cond_signal(&search_thread.cond);
+    pthread_mutex_unlock(&search_thread.lock);
+    wait_for_search();
+}
+
+static void uci_ponderhit(void) {
+    if (!search_thread.running)
+        return;
+    pthread_mutex_lock(&search_thread.lock);
+    search_ponderhit(search_thread.si);
+    pthread_cond_signal(&search_thread.cond);
+    pthread_mutex_unlock(&search_thread.lock);
+}
+
+static void uci_go(struct Position *pos, struct Tokenizer *tk) {
+    bool infinite, ponder;
+    struct Search_limits limits = parse_go_limits(pos, tk, &infinite, &ponder);
+    limits.multipv = options.multipv;
+
+    //A book move would have to be sent right away, which is not allowed while pondering or before
+    //the stop of an infinite search.
+    char move_str[6];
+    struct Move book_move;
+    if (!ponder && !infinite && (int) pos->fullmove_count <= options.book_depth
+        && book_probe(pos, options.book_best_move, &book_move)) {
+        move_to_str(book_move, move_str);
+        printf("bestmove %s\n", move_str);
+        return;
     }
-    pthread_t search_thread;
-    int rc = pthread_create(&search_thread, NULL, uci_go_pthreads_wrap, (void*) pos);
-    if (rc) {
-        fprintf(stderr, "Non-zero return address when spawning thread: rc %d\n", rc);
-        exit(-1);
+
+    struct Search_info *si = malloc(sizeof(struct Search_info));
+    search_info_init(si, limits);
+    search_info_set_history(si, game_keys, num_game_keys);
+    si->ponder = ponder;
+    si->tt = &tt;
+
+    search_thread.pos = *pos;
+    search_thread.si = si;
+    search_thread.infinite = infinite;
+    if (pthread_create(&search_thread.thread, NULL, search_thread_main, &search_thread) != 0) {
+        puts("info string could not start the search thread");
+        search_info_destroy(si);
+        free(si);
+        return;
     }
+    search_thread.running = true;
+}
+
+static void print_options(void) {
+    printf("option name Hash type spin default %d min 1 max %d\n", TT_DEFAULT_MB, TT_MAX_MB);
+    puts("option name Clear Hash type button");
+    printf("option name MultiPV type spin default 1 min 1 max %d\n", MAX_MULTIPV);
+    puts("option name BookFile type string default <empty>");
+    printf("option name BookDepth type spin default %d min 0 max 500\n", options.book_depth);
+    printf("option name BookBestMove type check default %s\n", options.book_best_move ? "true" : "false");
+    puts("option name TablebasePath type string default <empty>");
+    //Pondering is driven by the GUI through go ponder, the option only tells it that we support it.
+    puts("option name Ponder type check default false");
 }
 
+//Extends span to the end of token, or starts it at token if it is empty.
+static void extend_span(struct Token *span, struct Token token) {
+    if (span->len == 0)
+        *span = token;
+    else
+        span->len = (size_t) (token.str + token.len - span->str);
+}
 
+/*
+    Parses "setoption name <id> [value <x>]". Both the name and the value may contain spaces,
+    they span from their first to their last token.
+*/
+static void uci_setoption(struct Tokenizer *tk) {
+    struct Token name = { "", 0 };
+    struct Token value = { "", 0 };
+    struct Token *target = NULL;
+
+    struct Token token;
+    while (next_token(tk, &token)) {
+        if (target == NULL && token_eq(token, "name"))
+            target = &name;
+        else if (target == &name && token_eq(token, "value"))
+            target = &value;
+        else if (target != NULL)
+            extend_span(target, token);
+    }
+    bool empty_value = value.len == 0 || token_eq(value, "<empty>");
+    if (value.len >= OPTION_STR_SZ) {
+        printf("info string value of %.*s is too long\n", (int) name.len, name.str);
+        return;
+    }
+
+    if (token_eq(name, "Hash")) {
+        long long mb = token_to_ll(value);
+        if (mb < 1 || mb > TT_MAX_MB)
+            printf("info string Hash must be between 1 and %d MB\n", TT_MAX_MB);
+        else if (tt_resize(&tt, (size_t) mb, 0))
+            options.hash_mb = (int) mb;
+        else
+            printf("info string could not allocate %lld MB, keeping %d MB\n", mb, options.hash_mb);
+    } else if (token_eq(name, "Clear Hash")) {
+        tt_clear(&tt, 0);
+    } else if (token_eq(name, "MultiPV")) {
+        long long multipv = token_to_ll(value);
+        options.multipv = (int) (multipv < 1 ? 1 : multipv > MAX_MULTIPV ? MAX_MULTIPV : multipv);
+    } else if (token_eq(name, "BookFile")) {
+        if (empty_value) {
+            book_close();
+            options.book_file[0] = '\0';
+        } else {
+            snprintf(options.book_file, OPTION_STR_SZ, "%.*s", (int) value.len, value.str);
+            if (!book_open(options.book_file)) {
+                printf("info string could not open book %s\n", options.book_file);
+                options.book_file[0] = '\0';
+            }
+        }
+    } else if (token_eq(name, "BookDepth")) {
+        options.book_depth = (int) token_to_ll(value);
+    } else if (token_eq(name, "BookBestMove")) {
+        options.book_best_move = token_eq(value, "true");
+    } else if (token_eq(name, "TablebasePath")) {
+        if (empty_value) {
+            tb_free();
+            options.tablebase_path[0] = '\0';
+        } else {
+            snprintf(options.tablebase_path, OPTION_STR_SZ, "%.*s", (int) value.len, value.str);
+            printf("info string found %d tablebases in %s\n", tb_init(options.tablebase_path),
+                   options.tablebase_path);
+        }
+    } else if (token_eq(name, "Ponder")) {
+        //Nothing to do, see print_options.
+    } else {
+        printf("info string unknown option %.*s\n", (int) name.len, name.str);
+    }
+}
 
 void uci_loop() {
-    struct Position pos;
-    char command_str[BUFF_SZ];
-    char *token = NULL;
-    pthread_t search_thread;
+    struct Position pos = pos_from_FEN(startpos_FEN);
+    //The line buffer grows to the longest command seen and is reused, so long move lists cost no allocations.
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
     setbuf(stdout, NULL);
+    if (!tt_resize(&tt, (size_t) options.hash_mb, 0))
+        puts("info string could not allocate the transposition table");
 
-    while (fgets(&command_str[0], BUFF_SZ, stdin)) {
-        token = strtok(command_str, separator);
+    while ((line_len = getline(&line, &line_cap, stdin)) != -1) {
+        struct Tokenizer tk = { line, line + line_len };
+        struct Token token;
+        if (!next_token(&tk, &token))
+            continue;
 
-        if (token == NULL || strncmp(token, "quit", 5) == 0)
+        if (token_eq(token, "quit"))
             break;
 
-        if (strncmp(token, "uci", 4) == 0) {
+        //Only these commands are handled while a search is running, the others wait for it to finish.
+        if (token_eq(token, "isready")) {
+            puts("readyok");
+            continue;
+        } else if (token_eq(token, "stop")) {
+            uci_stop();
+            continue;
+        } else if (token_eq(token, "ponderhit")) {
+            uci_ponderhit();
+            continue;
+        }
+        wait_for_search();
+
+        if (token_eq(token, "uci")) {
             puts("id name Chessbot2");
             puts("id author Felix Liu");
+            print_options();
             puts("uciok");
         }
 
-        else if (strncmp(token, "isready", 8) == 0)
-            puts("readyok");
+        else if (token_eq(token, "setoption"))
+            uci_setoption(&tk);
 
-        else if (strncmp(token, "position", 9) == 0)
-            uci_position(&pos, command_str);
+        else if (token_eq(token, "position"))
+            uci_position(&pos, &tk);
 
-        else if (strncmp(token, "ucinewgame", 11) == 0) {
+        else if (token_eq(token, "ucinewgame")) {
+            tt_clear(&tt, 0);
+#ifdef SEARCH_STATS
+            memset(&accumulated_stats, 0, sizeof(accumulated_stats));
+#endif
+        }
+        else if (token_eq(token, "go"))
+            uci_go(&pos, &tk);
+
+        //Non-standard extension: bench [depth] [threads] [hash]
+        else if (token_eq(token, "bench")) {
+            int args[3] = { 0, 0, 0 };
+            for (int i = 0; i < 3 && next_token(&tk, &token); ++i)
+                args[i] = (int) token_to_ll(token);
+            bench(args[0], args[1], args[2]);
+        }
+
+        //Non-standard extension, prints the current position.
+        else if (token_eq(token, "d")) {
+            char fen[FEN_MAX_LEN + 1];
+            pos_to_FEN(&pos, fen);
+            print_position(&pos);
+            printf("Fen: %s\nKey: %016llx\n", fen, (unsigned long long) pos.key);
+        }
 
+        //Non-standard extension, prints the search statistics collected since ucinewgame.
+        else if (token_eq(token, "stats")) {
+#ifdef SEARCH_STATS
+            print_search_stats(&accumulated_stats);
+#else
+            puts("info string search statistics are disabled, build with CHESSBOT_SEARCH_STATS=ON");
+#endif
         }
-        else if (strncmp(token, "go", 3) == 0)
-            uci_go(&pos);
 
     }
+    uci_stop();
+    tt_free(&tt);
+    free(game.start);
+    free(game.moves);
+    free(line);
 }
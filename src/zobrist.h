@@ -0,0 +1,27 @@
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+#include "types.h"
+
+struct Position;
+
+//Layout of the random numbers, following the Polyglot book format.
+//Pieces are indexed by 64 * kind + square, where kind is 2 * piece_type, plus one for white pieces.
+#define ZOBRIST_CASTLING_OFFSET 768
+#define ZOBRIST_EP_OFFSET 772
+#define ZOBRIST_TURN_OFFSET 780
+
+extern const u64 zobrist_random64[781];
+
+static inline u64 zobrist_piece(enum Piece p, enum Square sq) {
+    int kind = 2 * to_piece_type(p) + (piece_color(p) == WHITE ? 1 : 0);
+    return zobrist_random64[64 * kind + sq];
+}
+
+//The part of the key that doesn't depend on the pieces: castling rights, en passant file and side to move.
+u64 zobrist_state_key(const struct Position *pos);
+
+//Computes the key of the position from scratch. The key is identical to the Polyglot key of the position.
+u64 compute_key(const struct Position *pos);
+
+#endif
@@ -0,0 +1,963 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cargs.h>
+
+#include "attacks.h"
+#include "bitboard.h"
+#include "fen.h"
+#include "movegen.h"
+#include "position.h"
+#include "search.h"
+#include "tables.h"
+#include "zobrist.h"
+
+/*
+    Self-play match runner. Plays games between two UCI engines (by default two instances of
+    the engine itself) as local subprocesses, with several games running concurrently.
+    Every opening is played twice with colors reversed. Games are adjudicated on mate, stalemate,
+    the fifty-move rule, threefold repetition, insufficient material, and on the reported scores.
+    Prints Elo with its 95% error margin and, if configured, an SPRT decision.
+*/
+
+#define DEFAULT_ENGINE "./chessbot -u"
+#define DEFAULT_GAMES 100
+#define DEFAULT_DEPTH 6
+#define LINE_SZ 4096
+#define NAME_SZ 64
+#define MAX_GAME_PLIES 1024
+//Longest command sent to an engine: a position command with the FEN and every move of the game.
+#define CMD_SZ (64 + FEN_MAX_LEN + 6 * MAX_GAME_PLIES)
+#define SAN_SZ 8
+#define MAX_NUM_MOVES 256
+
+//An engine that doesn't answer within this time (beyond its clock) has stalled.
+#define STALL_TIMEOUT_MS 60000
+//Allowed time overrun before a game is lost on time, covers the communication latency.
+#define TIME_MARGIN_MS 100
+
+//Score adjudication: a side is lost if both engines agree on a score of at least RESIGN_SCORE
+//for RESIGN_PLIES consecutive plies, a game is drawn if both report scores within DRAW_SCORE for
+//DRAW_PLIES consecutive plies after DRAW_MIN_PLY.
+#define RESIGN_SCORE 1000
+#define RESIGN_PLIES 8
+#define DRAW_SCORE 10
+#define DRAW_PLIES 12
+#define DRAW_MIN_PLY 80
+
+//Scores reported as "mate n" are converted to centipawns.
+#define MATE_CP 100000
+
+static const char *startpos_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+static struct cag_option options[] = {
+    {
+     .identifier = '1',
+     .access_letters = "1",
+     .access_name = "engine1",
+     .value_name = "CMD",
+     .description = "Command of the first engine (default: " DEFAULT_ENGINE ")"
+    },
+    {
+     .identifier = '2',
+     .access_letters = "2",
+     .access_name = "engine2",
+     .value_name = "CMD",
+     .description = "Command of the second engine (default: same as the first)"
+    },
+    {
+     .identifier = 'g',
+     .access_letters = "g",
+     .access_name = "games",
+     .value_name = "GAMES",
+     .description = "Number of games"
+    },
+    {
+     .identifier = 'c',
+     .access_letters = "c",
+     .access_name = "concurrency",
+     .value_name = "N",
+     .description = "Number of games played at the same time"
+    },
+    {
+     .identifier = 'T',
+     .access_letters = "T",
+     .access_name = "tc",
+     .value_name = "BASE+INC",
+     .description = "Time control in seconds, e.g. 10+0.1"
+    },
+    {
+     .identifier = 'm',
+     .access_letters = "m",
+     .access_name = "movetime",
+     .value_name = "MS",
+     .description = "Fixed time per move in milliseconds"
+    },
+    {
+     .identifier = 'n',
+     .access_letters = "n",
+     .access_name = "nodes",
+     .value_name = "NODES",
+     .description = "Fixed number of nodes per move"
+    },
+    {
+     .identifier = 'd',
+     .access_letters = "d",
+     .access_name = "depth",
+     .value_name = "DEPTH",
+     .description = "Fixed depth per move (the default, at depth 6)"
+    },
+    {
+     .identifier = 'o',
+     .access_letters = "o",
+     .access_name = "openings",
+     .value_name = "FILE",
+     .description = "EPD or FEN file with the opening positions (default: the starting position)"
+    },
+    {
+     .identifier = 'p',
+     .access_letters = "p",
+     .access_name = "pgn",
+     .value_name = "FILE",
+     .description = "File the games are written to in PGN"
+    },
+    {
+     .identifier = 's',
+     .access_letters = "s",
+     .access_name = "sprt",
+     .value_name = "ELO0,ELO1",
+     .description = "Stop as soon as the SPRT accepts either hypothesis"
+    },
+    {
+     .identifier = 'a',
+     .access_letters = "a",
+     .access_name = "alpha",
+     .value_name = "ALPHA",
+     .description = "SPRT false positive rate (default 0.05)"
+    },
+    {
+     .identifier = 'b',
+     .access_letters = "b",
+     .access_name = "beta",
+     .value_name = "BETA",
+     .description = "SPRT false negative rate (default 0.05)"
+    },
+    {
+     .identifier = 'h',
+     .access_letters = "h",
+     .access_name = "help",
+     .value_name = NULL,
+     .description = "Show this help"
+    }
+};
+
+struct Engine {
+    pid_t pid;
+    int to_fd;
+    int from_fd;
+    char buff[LINE_SZ];
+    size_t buff_len;
+    char name[NAME_SZ];
+    bool alive;
+};
+
+struct Match_config {
+    const char *commands[2];
+    int num_games;
+    int concurrency;
+    long long base_time_ms;
+    long long increment_ms;
+    unsigned long movetime;
+    unsigned long long nodes;
+    int depth;
+    const char *openings_file;
+    const char *pgn_file;
+    bool sprt;
+    double elo0, elo1, alpha, beta;
+};
+
+enum Game_result { RESULT_NONE, WHITE_WINS, BLACK_WINS, DRAWN };
+
+struct Game {
+    char start_FEN[FEN_MAX_LEN + 1];
+    char san[MAX_GAME_PLIES][SAN_SZ];
+    int num_plies;
+    enum Game_result result;
+    const char *termination; //PGN termination tag
+    const char *reason;
+};
+
+struct Match {
+    struct Match_config config;
+    char (*openings)[FEN_MAX_LEN + 1];
+    int num_openings;
+    char engine_names[2][NAME_SZ];
+
+    pthread_mutex_t lock;
+    int next_game;
+    bool stop;
+    int wins, draws, losses; //From the point of view of the first engine
+    int games_done;
+    FILE *pgn;
+};
+
+struct Worker_args {
+    struct Match *match;
+};
+
+//Serializes process creation, so that no engine inherits the pipes of another.
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool engine_start(struct Engine *e, const char *cmd) {
+    int to_child[2], from_child[2];
+    //engine_quit only cleans up an engine that was started.
+    e->pid = 0;
+    e->alive = false;
+    e->buff_len = 0;
+    snprintf(e->name, NAME_SZ, "%s", cmd);
+
+    pthread_mutex_lock(&spawn_lock);
+    if (pipe(to_child) != 0) {
+        pthread_mutex_unlock(&spawn_lock);
+        return false;
+    }
+    if (pipe(from_child) != 0) {
+        close(to_child[0]);
+        close(to_child[1]);
+        pthread_mutex_unlock(&spawn_lock);
+        return false;
+    }
+    fcntl(to_child[1], F_SETFD, FD_CLOEXEC);
+    fcntl(from_child[0], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[0]);
+        close(from_child[1]);
+        execl("/bin/sh", "sh", "-c", cmd, (char*) NULL);
+        _exit(127);
+    }
+    close(to_child[0]);
+    close(from_child[1]);
+    pthread_mutex_unlock(&spawn_lock);
+
+    if (pid < 0) {
+        close(to_child[1]);
+        close(from_child[0]);
+        return false;
+    }
+
+    e->pid = pid;
+    e->to_fd = to_child[1];
+    e->from_fd = from_child[0];
+    e->alive = true;
+    return true;
+}
+
+static void engine_send(struct Engine *e, const char *fmt, ...) {
+    char line[CMD_SZ];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, CMD_SZ - 1, fmt, args);
+    va_end(args);
+    if (len < 0 || !e->alive)
+        return;
+    if (len > CMD_SZ - 2)
+        len = CMD_SZ - 2;
+    line[len++] = '\n';
+
+    for (int written = 0; written < len;) {
+        ssize_t n = write(e->to_fd, line + written, len - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            e->alive = false;
+            return;
+        }
+        written += (int) n;
+    }
+}
+
+//Reads one line from the engine, waiting until deadline (a get_time_ms value).
+//Returns false if the engine exited or didn't send a full line in time.
+static bool engine_read_line(struct Engine *e, char *line, long long deadline) {
+    for (;;) {
+        char *newline = memchr(e->buff, '\n', e->buff_len);
+        if (newline != NULL) {
+            size_t len = newline - e->buff;
+            memcpy(line, e->buff, len);
+            line[len] = '\0';
+            if (len > 0 && line[len - 1] == '\r')
+                line[len - 1] = '\0';
+            e->buff_len -= len + 1;
+            memmove(e->buff, newline + 1, e->buff_len);
+            return true;
+        }
+
+        //Lines longer than the buffer are cut.
+        if (e->buff_len == LINE_SZ - 1) {
+            memcpy(line, e->buff, e->buff_len);
+            line[e->buff_len] = '\0';
+            e->buff_len = 0;
+            return true;
+        }
+
+        long long timeout = deadline - get_time_ms();
+        if (!e->alive || timeout <= 0)
+            return false;
+
+        struct pollfd pfd = { .fd = e->from_fd, .events = POLLIN };
+        int rc = poll(&pfd, 1, (int) timeout);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return false;
+
+        ssize_t n = read(e->from_fd, e->buff + e->buff_len, LINE_SZ - 1 - e->buff_len);
+        if (n <= 0) {
+            e->alive = false;
+            return false;
+        }
+        e->buff_len += n;
+    }
+}
+
+//Reads lines until one starts with prefix.
+static bool engine_wait_for(struct Engine *e, const char *prefix, char *line, long long deadline) {
+    size_t len = strlen(prefix);
+    while (engine_read_line(e, line, deadline)) {
+        if (strncmp(line, prefix, len) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool engine_init(struct Engine *e, const char *cmd) {
+    char line[LINE_SZ];
+    if (!engine_start(e, cmd))
+        return false;
+
+    engine_send(e, "uci");
+    long long deadline = get_time_ms() + STALL_TIMEOUT_MS;
+    while (engine_read_line(e, line, deadline)) {
+        if (strncmp(line, "id name ", 8) == 0)
+            snprintf(e->name, NAME_SZ, "%.*s", NAME_SZ - 1, line + 8);
+        else if (strcmp(line, "uciok") == 0)
+            return true;
+    }
+    return false;
+}
+
+static void engine_quit(struct Engine *e) {
+    if (e->pid <= 0)
+        return;
+    engine_send(e, "quit");
+    close(e->to_fd);
+    close(e->from_fd);
+    //Give the engine a moment to exit on its own before killing it.
+    for (int i = 0; i < 50 && waitpid(e->pid, NULL, WNOHANG) == 0; ++i) {
+        struct timespec ts = { 0, 10 * 1000000 };
+        nanosleep(&ts, NULL);
+        if (i == 49) {
+            kill(e->pid, SIGKILL);
+            waitpid(e->pid, NULL, 0);
+        }
+    }
+    e->pid = 0;
+    e->alive = false;
+}
+
+static bool insufficient_material(const struct Position *pos) {
+    u64 pawns_rooks_queens = 0;
+    for (int side = WHITE; side <= BLACK; ++side)
+        pawns_rooks_queens |= pos->piece_bb[PAWN][side] | pos->piece_bb[ROOK][side] | pos->piece_bb[QUEEN][side];
+    //Kings only, or kings and a single minor piece.
+    return !pawns_rooks_queens && popcount(pos_occupancy(pos)) <= 3;
+}
+
+static bool find_move(struct Position *pos, const char *move_str, struct Move *move) {
+    struct Move move_list[MAX_NUM_MOVES];
+    int num_moves = generate_moves(move_list, pos);
+    for (int i = 0; i < num_moves; ++i) {
+        char str[6];
+        move_to_str(move_list[i], str);
+        if (strcmp(str, move_str) == 0) {
+            *move = move_list[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static void set_result(struct Game *game, enum Game_result result, const char *termination, const char *reason) {
+    game->result = result;
+    game->termination = termination;
+    game->reason = reason;
+}
+
+//Result in which the side loses.
+static enum Game_result loss_for(enum Side side) {
+    return side == WHITE ? BLACK_WINS : WHITE_WINS;
+}
+
+//Adjudicates the position before the side to move makes a move. Returns true if the game is over.
+static bool adjudicate_rules(struct Game *game, struct Position *pos, const u64 *keys, int num_keys) {
+    struct Move move_list[MAX_NUM_MOVES];
+    if (generate_moves(move_list, pos) == 0) {
+        enum Side us = pos->side_to_move;
+        if (pos_in_check(pos))
+            set_result(game, loss_for(us), "normal", us == WHITE ? "Black mates" : "White mates");
+        else
+            set_result(game, DRAWN, "normal", "Stalemate");
+        return true;
+    }
+
+    if (pos->half_move_clock >= 100) {
+        set_result(game, DRAWN, "normal", "Fifty move rule");
+        return true;
+    }
+
+    //Repetitions can only happen since the last irreversible move.
+    int repetitions = 1;
+    for (int i = num_keys - 3; i >= 0 && i >= num_keys - 1 - (int) pos->half_move_clock; i -= 2)
+        repetitions += keys[i] == keys[num_keys - 1];
+    if (repetitions >= 3) {
+        set_result(game, DRAWN, "normal", "Threefold repetition");
+        return true;
+    }
+
+    if (insufficient_material(pos)) {
+        set_result(game, DRAWN, "normal", "Insufficient material");
+        return true;
+    }
+
+    if (game->num_plies >= MAX_GAME_PLIES) {
+        set_result(game, DRAWN, "adjudication", "Maximum game length");
+        return true;
+    }
+
+    return false;
+}
+
+//Parses the score of an info line, from the point of view of the engine.
+static bool parse_score(const char *line, int *score) {
+    const char *p = strstr(line, " score ");
+    if (p == NULL)
+        return false;
+    int value;
+    if (sscanf(p, " score cp %d", &value) == 1) {
+        *score = value;
+        return true;
+    }
+    if (sscanf(p, " score mate %d", &value) == 1) {
+        *score = value > 0 ? MATE_CP - value : -MATE_CP - value;
+        return true;
+    }
+    return false;
+}
+
+//Plays one game. engines[WHITE] plays white.
+static void play_game(struct Match *match, struct Engine *engines[2], const char *start_FEN, struct Game *game) {
+    const struct Match_config *config = &match->config;
+    char line[LINE_SZ];
+    //The moves of the game in UCI notation, each preceded by a space.
+    char moves[6 * MAX_GAME_PLIES + 1] = "";
+    size_t moves_len = 0;
+    u64 keys[MAX_GAME_PLIES + 1];
+    long long clock[2] = { config->base_time_ms, config->base_time_ms };
+    int resign_plies[2] = { 0, 0 };
+    int draw_plies = 0;
+
+    struct Position pos;
+    fen_parse(start_FEN, start_FEN + strlen(start_FEN), &pos, NULL);
+    MS_Stack *move_stack = stk_create(MAX_GAME_PLIES);
+
+    snprintf(game->start_FEN, sizeof(game->start_FEN), "%s", start_FEN);
+    game->num_plies = 0;
+    game->result = RESULT_NONE;
+    keys[0] = compute_key(&pos);
+
+    for (int i = 0; i < 2; ++i) {
+        engine_send(engines[i], "ucinewgame");
+        engine_send(engines[i], "isready");
+        engine_wait_for(engines[i], "readyok", line, get_time_ms() + STALL_TIMEOUT_MS);
+    }
+
+    while (!adjudicate_rules(game, &pos, keys, game->num_plies + 1)) {
+        enum Side us = pos.side_to_move;
+        struct Engine *engine = engines[us];
+
+        //The whole game is sent, so that the engine knows the positions that already occurred.
+        if (moves_len > 0)
+            engine_send(engine, "position fen %s moves%s", start_FEN, moves);
+        else
+            engine_send(engine, "position fen %s", start_FEN);
+
+        long long deadline;
+        if (config->base_time_ms) {
+            engine_send(engine, "go wtime %lld btime %lld winc %lld binc %lld", clock[WHITE], clock[BLACK],
+                        config->increment_ms, config->increment_ms);
+            deadline = get_time_ms() + clock[us] + TIME_MARGIN_MS;
+        } else if (config->movetime) {
+            engine_send(engine, "go movetime %lu", config->movetime);
+            deadline = get_time_ms() + config->movetime + STALL_TIMEOUT_MS;
+        } else if (config->nodes) {
+            engine_send(engine, "go nodes %llu", config->nodes);
+            deadline = get_time_ms() + STALL_TIMEOUT_MS;
+        } else {
+            engine_send(engine, "go depth %d", config->depth);
+            deadline = get_time_ms() + STALL_TIMEOUT_MS;
+        }
+
+        long long start = get_time_ms();
+        int score = 0;
+        bool has_score = false;
+        bool got_move = false;
+        while (engine_read_line(engine, line, deadline)) {
+            if (strncmp(line, "info ", 5) == 0 && parse_score(line, &score)) {
+                has_score = true;
+            } else if (strncmp(line, "bestmove ", 9) == 0) {
+                got_move = true;
+                break;
+            }
+        }
+        long long elapsed = get_time_ms() - start;
+
+        if (!got_move) {
+            if (!engine->alive)
+                set_result(game, loss_for(us), "rules infraction", "Engine disconnected");
+            else if (config->base_time_ms)
+                set_result(game, loss_for(us), "time forfeit", "Loses on time");
+            else
+                set_result(game, loss_for(us), "rules infraction", "Engine stalled");
+            break;
+        }
+        if (config->base_time_ms) {
+            clock[us] -= elapsed;
+            if (clock[us] < -TIME_MARGIN_MS) {
+                set_result(game, loss_for(us), "time forfeit", "Loses on time");
+                break;
+            }
+            clock[us] = (clock[us] > 0 ? clock[us] : 0) + config->increment_ms;
+        }
+
+        char move_str[8];
+        struct Move move;
+        if (sscanf(line + 9, "%7s", move_str) != 1 || !find_move(&pos, move_str, &move)) {
+            set_result(game, loss_for(us), "rules infraction", "Illegal move");
+            break;
+        }
+
+        move_to_san(move, &pos, game->san[game->num_plies]);
+        moves[moves_len++] = ' ';
+        move_to_str(move, &moves[moves_len]);
+        moves_len += strlen(&moves[moves_len]);
+        make_move(move, &pos, move_stack);
+        keys[++game->num_plies] = compute_key(&pos);
+
+        //Score adjudication, both engines have to agree.
+        if (has_score) {
+            int white_score = (us == WHITE) ? score : -score;
+            if (white_score >= RESIGN_SCORE) {
+                resign_plies[BLACK]++;
+                resign_plies[WHITE] = 0;
+            } else if (white_score <= -RESIGN_SCORE) {
+                resign_plies[WHITE]++;
+                resign_plies[BLACK] = 0;
+            } else {
+                resign_plies[WHITE] = resign_plies[BLACK] = 0;
+            }
+            draw_plies = (abs(score) <= DRAW_SCORE) ? draw_plies + 1 : 0;
+        } else {
+            resign_plies[WHITE] = resign_plies[BLACK] = draw_plies = 0;
+        }
+
+        if (resign_plies[WHITE] >= RESIGN_PLIES || resign_plies[BLACK] >= RESIGN_PLIES) {
+            enum Side loser = resign_plies[WHITE] >= RESIGN_PLIES ? WHITE : BLACK;
+            set_result(game, loss_for(loser), "adjudication", loser == WHITE ? "White resigns" : "Black resigns");
+            break;
+        }
+        if (draw_plies >= DRAW_PLIES && game->num_plies >= DRAW_MIN_PLY) {
+            set_result(game, DRAWN, "adjudication", "Draw by adjudication");
+            break;
+        }
+    }
+
+    stk_destroy(move_stack);
+}
+
+static const char *result_str(enum Game_result result) {
+    switch (result) {
+        case WHITE_WINS:
+            return "1-0";
+        case BLACK_WINS:
+            return "0-1";
+        case DRAWN:
+            return "1/2-1/2";
+        default:
+            return "*";
+    }
+}
+
+static void write_pgn(FILE *f, const struct Game *game, int round, const char *white, const char *black) {
+    char date[16];
+    time_t now = time(NULL);
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    strftime(date, sizeof(date), "%Y.%m.%d", &tm_now);
+
+    fprintf(f, "[Event \"Chessbot2 self-play\"]\n[Site \"local\"]\n[Date \"%s\"]\n[Round \"%d\"]\n", date, round);
+    fprintf(f, "[White \"%s\"]\n[Black \"%s\"]\n[Result \"%s\"]\n", white, black, result_str(game->result));
+    if (strcmp(game->start_FEN, startpos_FEN) != 0)
+        fprintf(f, "[FEN \"%s\"]\n[SetUp \"1\"]\n", game->start_FEN);
+    fprintf(f, "[PlyCount \"%d\"]\n[Termination \"%s\"]\n\n", game->num_plies, game->termination);
+
+    struct Position pos;
+    fen_parse(game->start_FEN, game->start_FEN + strlen(game->start_FEN), &pos, NULL);
+    int move_number = pos.fullmove_count;
+    bool black_first = pos.side_to_move == BLACK;
+    int line_len = 0;
+    for (int ply = 0; ply < game->num_plies; ++ply) {
+        bool white_move = (ply % 2 == 0) != black_first;
+        char token[32];
+        if (white_move)
+            snprintf(token, sizeof(token), "%d. %s", move_number, game->san[ply]);
+        else if (ply == 0)
+            snprintf(token, sizeof(token), "%d... %s", move_number, game->san[ply]);
+        else
+            snprintf(token, sizeof(token), "%s", game->san[ply]);
+        if (!white_move)
+            ++move_number;
+
+        int len = (int) strlen(token);
+        if (line_len + len + 1 > 79) {
+            fputc('\n', f);
+            line_len = 0;
+        } else if (line_len > 0) {
+            fputc(' ', f);
+            ++line_len;
+        }
+        fputs(token, f);
+        line_len += len;
+    }
+    fprintf(f, "%s{%s} %s\n\n", line_len ? " " : "", game->reason, result_str(game->result));
+}
+
+static double elo_from_score(double score) {
+    return 400.0 * log10(score / (1.0 - score));
+}
+
+/*
+    Log-likelihood ratio of the GSPRT for elo1 against elo0, using the normal approximation of
+    the trinomial (win/draw/loss) model.
+*/
+static double sprt_llr(int wins, int draws, int losses, double elo0, double elo1) {
+    int n = wins + draws + losses;
+    if (n == 0)
+        return 0.0;
+    double score = (wins + 0.5 * draws) / n;
+    double variance = (wins * pow(1.0 - score, 2) + draws * pow(0.5 - score, 2) + losses * pow(score, 2)) / n;
+    if (variance <= 0.0)
+        return 0.0;
+    double s0 = 1.0 / (1.0 + pow(10.0, -elo0 / 400.0));
+    double s1 = 1.0 / (1.0 + pow(10.0, -elo1 / 400.0));
+    return (s1 - s0) * (2.0 * score - s0 - s1) / (2.0 * variance / n);
+}
+
+//Prints the current score. Returns true if the SPRT has reached a decision. Called with the match lock held.
+static bool print_stats(struct Match *match) {
+    int n = match->wins + match->draws + match->losses;
+    double score = (match->wins + 0.5 * match->draws) / n;
+    printf("Score of %s vs %s: %d - %d - %d  [%.3f] %d\n", match->engine_names[0], match->engine_names[1],
+           match->wins, match->losses, match->draws, score, n);
+
+    double variance = (match->wins * pow(1.0 - score, 2) + match->draws * pow(0.5 - score, 2)
+                       + match->losses * pow(score, 2)) / n;
+    double margin = 1.96 * sqrt(variance / n);
+    if (score > 0.0 && score < 1.0 && score - margin > 0.0 && score + margin < 1.0) {
+        double elo = elo_from_score(score);
+        printf("Elo difference: %.1f +/- %.1f\n", elo,
+               (elo_from_score(score + margin) - elo_from_score(score - margin)) / 2.0);
+    }
+
+    if (!match->config.sprt)
+        return false;
+
+    const struct Match_config *config = &match->config;
+    double llr = sprt_llr(match->wins, match->draws, match->losses, config->elo0, config->elo1);
+    double lower = log(config->beta / (1.0 - config->alpha));
+    double upper = log((1.0 - config->beta) / config->alpha);
+    printf("SPRT: llr %.2f (%.2f, %.2f) [%.1f, %.1f]\n", llr, lower, upper, config->elo0, config->elo1);
+    if (llr >= upper) {
+        puts("SPRT: H1 was accepted");
+        return true;
+    }
+    if (llr <= lower) {
+        puts("SPRT: H0 was accepted");
+        return true;
+    }
+    return false;
+}
+
+static void *match_worker(void *arg) {
+    struct Match *match = ((struct Worker_args*) arg)->match;
+    struct Engine engines[2] = {{0}};
+    struct Game *game = malloc(sizeof(struct Game));
+
+    for (int i = 0; i < 2; ++i) {
+        if (!engine_init(&engines[i], match->config.commands[i]))
+            fprintf(stderr, "Could not start %s\n", match->config.commands[i]);
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&match->lock);
+        int game_idx = match->next_game++;
+        bool done = match->stop || game_idx >= match->config.num_games;
+        pthread_mutex_unlock(&match->lock);
+        if (done)
+            break;
+
+        //Game pairs play the same opening with colors reversed.
+        const char *opening = match->openings[(game_idx / 2) % match->num_openings];
+        int first_color = game_idx % 2; //Color of the first engine
+        struct Engine *players[2];
+        players[first_color] = &engines[0];
+        players[!first_color] = &engines[1];
+        play_game(match, players, opening, game);
+
+        //Restart engines that crashed or stalled.
+        for (int i = 0; i < 2; ++i) {
+            if (!engines[i].alive) {
+                engine_quit(&engines[i]);
+                engine_init(&engines[i], match->config.commands[i]);
+            }
+        }
+
+        pthread_mutex_lock(&match->lock);
+        const char *white = match->engine_names[first_color == WHITE ? 0 : 1];
+        const char *black = match->engine_names[first_color == WHITE ? 1 : 0];
+        printf("Finished game %d (%s vs %s): %s {%s}\n", game_idx + 1, white, black,
+               result_str(game->result), game->reason);
+        if (game->result == DRAWN)
+            match->draws++;
+        else if ((game->result == WHITE_WINS) == (first_color == WHITE))
+            match->wins++;
+        else
+            match->losses++;
+        match->games_done++;
+        if (match->pgn) {
+            write_pgn(match->pgn, game, game_idx + 1, white, black);
+            fflush(match->pgn);
+        }
+        if (print_stats(match))
+            match->stop = true;
+        fflush(stdout);
+        pthread_mutex_unlock(&match->lock);
+    }
+
+    for (int i = 0; i < 2; ++i)
+        engine_quit(&engines[i]);
+    free(game);
+    return NULL;
+}
+
+static bool load_openings(struct Match *match) {
+    if (match->config.openings_file == NULL) {
+        match->openings = malloc(sizeof(*match->openings));
+        snprintf(match->openings[0], FEN_MAX_LEN + 1, "%s", startpos_FEN);
+        match->num_openings = 1;
+        return true;
+    }
+
+    struct Mapped_file file;
+    if (!map_file(match->config.openings_file, &file)) {
+        fprintf(stderr, "Could not open %s\n", match->config.openings_file);
+        return false;
+    }
+
+    int capacity = 256;
+    match->openings = malloc(capacity * sizeof(*match->openings));
+    match->num_openings = 0;
+    const char *cursor = file.data;
+    const char *line;
+    size_t len;
+    int line_number = 0;
+    while (next_line(&cursor, file.data + file.size, &line, &len)) {
+        ++line_number;
+        struct Position pos;
+        if (len == 0 || line[0] == '#')
+            continue;
+        enum Fen_error err = fen_parse(line, line + len, &pos, NULL);
+        if (err != FEN_OK) {
+            fprintf(stderr, "%s:%d: %s\n", match->config.openings_file, line_number, fen_error_str(err));
+            continue;
+        }
+        if (match->num_openings == capacity) {
+            capacity *= 2;
+            match->openings = realloc(match->openings, capacity * sizeof(*match->openings));
+        }
+        pos_to_FEN(&pos, match->openings[match->num_openings++]);
+    }
+
+    unmap_file(&file);
+    if (match->num_openings == 0) {
+        fprintf(stderr, "No valid openings in %s\n", match->config.openings_file);
+        return false;
+    }
+    return true;
+}
+
+//Reads the names of the engines, and makes them distinct if both are the same engine.
+static bool read_engine_names(struct Match *match) {
+    for (int i = 0; i < 2; ++i) {
+        struct Engine e = {0};
+        if (!engine_init(&e, match->config.commands[i])) {
+            fprintf(stderr, "Could not start %s\n", match->config.commands[i]);
+            engine_quit(&e);
+            return false;
+        }
+        snprintf(match->engine_names[i], NAME_SZ, "%s", e.name);
+        engine_quit(&e);
+    }
+
+    if (strcmp(match->engine_names[0], match->engine_names[1]) == 0) {
+        for (int i = 0; i < 2; ++i) {
+            size_t len = strlen(match->engine_names[i]);
+            snprintf(match->engine_names[i] + len, NAME_SZ - len, " #%d", i + 1);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    struct Match match = {0};
+    struct Match_config *config = &match.config;
+    config->commands[0] = DEFAULT_ENGINE;
+    config->num_games = DEFAULT_GAMES;
+    config->concurrency = 1;
+    config->alpha = 0.05;
+    config->beta = 0.05;
+
+    cag_option_context ctx;
+    cag_option_prepare(&ctx, options, CAG_ARRAY_SIZE(options), argc, argv);
+    while (cag_option_fetch(&ctx)) {
+        const char *value = cag_option_get_value(&ctx);
+        switch (cag_option_get(&ctx)) {
+            case '1':
+                config->commands[0] = value;
+                break;
+            case '2':
+                config->commands[1] = value;
+                break;
+            case 'g':
+                config->num_games = atoi(value);
+                break;
+            case 'c':
+                config->concurrency = atoi(value);
+                break;
+            case 'T': {
+                double base = 0.0, increment = 0.0;
+                if (sscanf(value, "%lf+%lf", &base, &increment) < 1 || base <= 0.0) {
+                    fprintf(stderr, "Invalid time control %s\n", value);
+                    return EXIT_FAILURE;
+                }
+                config->base_time_ms = (long long) (base * 1000);
+                config->increment_ms = (long long) (increment * 1000);
+                break;
+            }
+            case 'm':
+                config->movetime = strtoul(value, NULL, 10);
+                break;
+            case 'n':
+                config->nodes = strtoull(value, NULL, 10);
+                break;
+            case 'd':
+                config->depth = atoi(value);
+                break;
+            case 'o':
+                config->openings_file = value;
+                break;
+            case 'p':
+                config->pgn_file = value;
+                break;
+            case 's':
+                if (sscanf(value, "%lf,%lf", &config->elo0, &config->elo1) != 2 || config->elo0 >= config->elo1) {
+                    fprintf(stderr, "Invalid SPRT bounds %s\n", value);
+                    return EXIT_FAILURE;
+                }
+                config->sprt = true;
+                break;
+            case 'a':
+                config->alpha = atof(value);
+                break;
+            case 'b':
+                config->beta = atof(value);
+                break;
+            case 'h':
+                printf("Usage: match [OPTION]...\nPlays games between two UCI engines.\n");
+                cag_option_print(options, CAG_ARRAY_SIZE(options), stdout);
+                return EXIT_SUCCESS;
+        }
+    }
+
+    if (config->commands[1] == NULL)
+        config->commands[1] = config->commands[0];
+    if (config->concurrency < 1)
+        config->concurrency = 1;
+    if (!config->base_time_ms && !config->movetime && !config->nodes && config->depth <= 0)
+        config->depth = DEFAULT_DEPTH;
+
+    //Writing to an engine that exited must not kill the match.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    init_LUTs();
+    if (!load_openings(&match) || !read_engine_names(&match))
+        return EXIT_FAILURE;
+
+    if (config->pgn_file) {
+        match.pgn = fopen(config->pgn_file, "a");
+        if (match.pgn == NULL) {
+            fprintf(stderr, "Could not open %s\n", config->pgn_file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    pthread_mutex_init(&match.lock, NULL);
+    pthread_t *threads = malloc(config->concurrency * sizeof(pthread_t));
+    struct Worker_args args = { &match };
+    for (int i = 0; i < config->concurrency; ++i) {
+        int rc = pthread_create(&threads[i], NULL, match_worker, &args);
+        if (rc) {
+            fprintf(stderr, "Non-zero return address when spawning thread: rc %d\n", rc);
+            exit(-1);
+        }
+    }
+    for (int i = 0; i < config->concurrency; ++i)
+        pthread_join(threads[i], NULL);
+
+    printf("Finished match: %d games\n", match.games_done);
+    pthread_mutex_destroy(&match.lock);
+    free(threads);
+    free(match.openings);
+    if (match.pgn)
+        fclose(match.pgn);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,453 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cargs.h>
+
+#include "attacks.h"
+#include "bitboard.h"
+#include "movegen.h"
+#include "position.h"
+#include "tablebase.h"
+#include "tables.h"
+
+/*
+    Offline generator for the endgame tables probed by the engine.
+
+    Tables are solved by retrograde analysis. Every position first gets the number of moves that stay
+    within the table, and the best result reachable through captures and promotions, which lead into
+    smaller tables that must already exist. Then, one ply at a time:
+    - the predecessors of a position lost in n plies are won in n + 1,
+    - a position lost in n plies takes one move away from each predecessor, and a predecessor
+      without any moves left (and no capture or promotion to save it) is lost in n + 1.
+    Predecessors are found with un-moves, i.e. moves generated backwards from the current position.
+    Positions that are never resolved are draws.
+
+    En passant is ignored: positions after a double push are treated as if no capture was possible.
+*/
+
+#define MAX_NUM_MOVES 256
+#define CHUNK_SZ 4096
+#define DEFAULT_OUTPUT_DIR "."
+
+//Extra values used during generation, next to the TB_ values of tablebase.h.
+#define UNKNOWN 253
+#define NO_CONVERSION TB_INVALID
+
+static struct cag_option options[] = {
+    {
+     .identifier = 't',
+     .access_letters = "t",
+     .access_name = "threads",
+     .value_name = "THREADS",
+     .description = "Number of threads (default: number of cores)"
+    },
+    {
+     .identifier = 'o',
+     .access_letters = "o",
+     .access_name = "output",
+     .value_name = "DIR",
+     .description = "Directory the tables are written to and read from"
+    },
+    {
+     .identifier = 'n',
+     .access_letters = "n",
+     .access_name = "pieces",
+     .value_name = "PIECES",
+     .description = "Generate all tables with up to this many pieces (default 4)"
+    },
+    {
+     .identifier = 'h',
+     .access_letters = "h",
+     .access_name = "help",
+     .value_name = NULL,
+     .description = "Show this help"
+    }
+};
+
+struct Generator {
+    struct Tb_material mat;
+    u64 size;
+
+    //Result of every position, TB_ values or UNKNOWN.
+    _Atomic unsigned char *result;
+    //Number of moves within the table not yet known to lose.
+    _Atomic unsigned char *moves_left;
+    //Best result reachable with a capture or promotion, or NO_CONVERSION.
+    unsigned char *conversion;
+
+    int level;
+    atomic_ullong next_chunk;
+    atomic_ullong num_changed;
+    atomic_int max_conversion_dtm;
+    atomic_bool missing_table;
+};
+
+typedef void (*Range_fn)(struct Generator *gen, u64 begin, u64 end);
+
+struct Worker_args {
+    struct Generator *gen;
+    Range_fn fn;
+};
+
+static inline bool is_win(unsigned char v) {
+    return v != TB_DRAW && v < TB_LOSS_OFFSET;
+}
+
+static inline bool is_loss(unsigned char v) {
+    return v >= TB_LOSS_OFFSET && v <= TB_LOSS_OFFSET + TB_MAX_DTM;
+}
+
+//Higher is better for the side to move.
+static int value_rank(unsigned char v) {
+    if (v == NO_CONVERSION)
+        return -10000;
+    struct Tb_result res = tb_decode_value(v);
+    return res.wdl > 0 ? 1000 - res.dtm : res.wdl < 0 ? -1000 + res.dtm : 0;
+}
+
+static inline bool in_check(enum Side side, const struct Position *pos) {
+    return attackers_to(lsb(pos->piece_bb[KING][side]), pos, side) != 0;
+}
+
+static void *worker(void *arg) {
+    struct Worker_args *args = arg;
+    struct Generator *gen = args->gen;
+    for (;;) {
+        u64 begin = atomic_fetch_add(&gen->next_chunk, CHUNK_SZ);
+        if (begin >= gen->size)
+            break;
+        u64 end = begin + CHUNK_SZ < gen->size ? begin + CHUNK_SZ : gen->size;
+        args->fn(gen, begin, end);
+    }
+    return NULL;
+}
+
+static void run_parallel(struct Generator *gen, Range_fn fn, int num_threads) {
+    pthread_t threads[num_threads];
+    struct Worker_args args = { gen, fn };
+    atomic_store(&gen->next_chunk, 0);
+    for (int i = 0; i < num_threads; ++i) {
+        int rc = pthread_create(&threads[i], NULL, worker, &args);
+        if (rc) {
+            fprintf(stderr, "Non-zero return address when spawning thread: rc %d\n", rc);
+            exit(-1);
+        }
+    }
+    for (int i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+static void init_range(struct Generator *gen, u64 begin, u64 end) {
+    MS_Stack *move_stack = stk_create(4);
+    struct Move move_list[MAX_NUM_MOVES];
+    struct Position pos;
+
+    for (u64 idx = begin; idx < end; ++idx) {
+        atomic_store_explicit(&gen->moves_left[idx], 0, memory_order_relaxed);
+        gen->conversion[idx] = NO_CONVERSION;
+
+        //Overlapping pieces, or the side not to move in check.
+        if (!tb_index_to_position(&gen->mat, idx, &pos) || in_check(!pos.side_to_move, &pos)) {
+            atomic_store_explicit(&gen->result[idx], TB_INVALID, memory_order_relaxed);
+            continue;
+        }
+
+        int num_moves = generate_moves(move_list, &pos);
+        int in_table = 0;
+        unsigned char best = NO_CONVERSION;
+        for (int i = 0; i < num_moves; ++i) {
+            struct Move m = move_list[i];
+            if (pos.piece_list[m.to_sq] == PIECE_EMPTY && m.promotion_type == PT_NULL) {
+                ++in_table;
+                continue;
+            }
+
+            struct Tb_result child;
+            make_move(m, &pos, move_stack);
+            bool found = tb_probe(&pos, &child);
+            unmake_move(m, &pos, move_stack);
+            if (!found) {
+                atomic_store(&gen->missing_table, true);
+                continue;
+            }
+
+            unsigned char value = tb_encode_value(-child.wdl, child.wdl ? child.dtm + 1 : 0);
+            if (value_rank(value) > value_rank(best))
+                best = value;
+        }
+
+        unsigned char result = UNKNOWN;
+        if (num_moves == 0)
+            result = in_check(pos.side_to_move, &pos) ? tb_encode_value(-1, 0) : TB_DRAW;
+
+        if (best != NO_CONVERSION && best != TB_DRAW) {
+            int dtm = tb_decode_value(best).dtm;
+            int current = atomic_load(&gen->max_conversion_dtm);
+            while (dtm > current && !atomic_compare_exchange_weak(&gen->max_conversion_dtm, &current, dtm))
+                ;
+        }
+
+        gen->conversion[idx] = best;
+        atomic_store_explicit(&gen->moves_left[idx], (unsigned char) in_table, memory_order_relaxed);
+        atomic_store_explicit(&gen->result[idx], result, memory_order_relaxed);
+    }
+
+    stk_destroy(move_stack);
+}
+
+static bool set_result(struct Generator *gen, u64 idx, unsigned char value) {
+    unsigned char expected = UNKNOWN;
+    if (atomic_compare_exchange_strong_explicit(&gen->result[idx], &expected, value,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&gen->num_changed, 1, memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+//Called when a predecessor has no moves left within the table that avoid a loss.
+static void resolve_lost(struct Generator *gen, u64 idx) {
+    unsigned char conversion = gen->conversion[idx];
+    //A capture or promotion that loses more slowly is resolved by the scan at its own level.
+    if (conversion == NO_CONVERSION || (is_loss(conversion) && conversion - TB_LOSS_OFFSET <= gen->level))
+        set_result(gen, idx, tb_encode_value(-1, gen->level));
+}
+
+//Visits all predecessors of the positions resolved at the previous level.
+static void propagate_range(struct Generator *gen, u64 begin, u64 end) {
+    const unsigned char prev_win = (unsigned char) (gen->level - 1);
+    const unsigned char prev_loss = tb_encode_value(-1, gen->level - 1);
+    struct Position pos;
+
+    for (u64 idx = begin; idx < end; ++idx) {
+        unsigned char value = atomic_load_explicit(&gen->result[idx], memory_order_relaxed);
+        bool lost = value == prev_loss;
+        if (!lost && !(value == prev_win && is_win(value)))
+            continue;
+
+        tb_index_to_position(&gen->mat, idx, &pos);
+        enum Side mover = !pos.side_to_move;
+        u64 empty = ~pos_occupancy(&pos);
+        u64 movers = pos.occupied_squares[mover];
+
+        while (movers) {
+            enum Square to = pop_lsb(&movers);
+            enum Piece piece = pos.piece_list[to];
+            enum Piece_type pt = to_piece_type(piece);
+
+            u64 from_squares;
+            if (pt == PAWN) {
+                int back = (mover == WHITE) ? -8 : 8;
+                enum Rank double_push_rank = (mover == WHITE) ? RANK_4 : RANK_5;
+                enum Rank first_rank = (mover == WHITE) ? RANK_2 : RANK_7;
+                from_squares = 0;
+                if (sq_rank(to) != first_rank && is_set(to + back, empty)) {
+                    from_squares |= set_bit(to + back);
+                    if (sq_rank(to) == double_push_rank && is_set(to + 2 * back, empty))
+                        from_squares |= set_bit(to + 2 * back);
+                }
+            } else {
+                from_squares = attacks_from(pt, &pos, to) & empty;
+            }
+
+            while (from_squares) {
+                enum Square from = pop_lsb(&from_squares);
+                struct Position prev = pos;
+                u64 change = set_bit(from) | set_bit(to);
+                prev.piece_list[from] = piece;
+                prev.piece_list[to] = PIECE_EMPTY;
+                prev.piece_bb[pt][mover] ^= change;
+                prev.occupied_squares[mover] ^= change;
+                prev.empty_squares ^= change;
+                prev.side_to_move = mover;
+                prev.attack_info.valid = false;
+
+                //The side that is to move in pos can't be in check before the move.
+                if (in_check(pos.side_to_move, &prev))
+                    continue;
+
+                u64 prev_idx = tb_position_to_index(&gen->mat, &prev, false);
+                if (lost) {
+                    set_result(gen, prev_idx, (unsigned char) gen->level);
+                } else if (atomic_load_explicit(&gen->result[prev_idx], memory_order_relaxed) == UNKNOWN
+                           && atomic_fetch_sub_explicit(&gen->moves_left[prev_idx], 1, memory_order_relaxed) == 1) {
+                    resolve_lost(gen, prev_idx);
+                }
+            }
+        }
+    }
+}
+
+//Resolves positions whose result at this level comes from a capture or promotion.
+static void scan_range(struct Generator *gen, u64 begin, u64 end) {
+    for (u64 idx = begin; idx < end; ++idx) {
+        if (atomic_load_explicit(&gen->result[idx], memory_order_relaxed) != UNKNOWN)
+            continue;
+
+        unsigned char conversion = gen->conversion[idx];
+        if (conversion == NO_CONVERSION || conversion == TB_DRAW)
+            continue;
+
+        struct Tb_result res = tb_decode_value(conversion);
+        if (res.dtm != gen->level)
+            continue;
+        if (res.wdl > 0 || atomic_load_explicit(&gen->moves_left[idx], memory_order_relaxed) == 0)
+            set_result(gen, idx, conversion);
+    }
+}
+
+static void print_summary(const struct Generator *gen, double seconds) {
+    u64 counts[2][3] = {{0}};
+    int longest = 0;
+    for (u64 idx = 0; idx < gen->size; ++idx) {
+        unsigned char value = gen->result[idx];
+        if (value == TB_INVALID)
+            continue;
+        struct Tb_result res = tb_decode_value(value);
+        enum Side stm = (enum Side) (idx / (gen->size / 2));
+        counts[stm][res.wdl + 1]++;
+        if (res.dtm > longest)
+            longest = res.dtm;
+    }
+
+    printf("%s: %llu entries, %.1f s, longest mate %d plies\n", gen->mat.name,
+           (unsigned long long) gen->size, seconds, longest);
+    for (int stm = WHITE; stm <= BLACK; ++stm) {
+        printf("  %s to move: %llu wins, %llu draws, %llu losses\n", stm == WHITE ? "white" : "black",
+               (unsigned long long) counts[stm][2], (unsigned long long) counts[stm][1],
+               (unsigned long long) counts[stm][0]);
+    }
+}
+
+static bool generate(const struct Tb_material *mat, const char *dir, int num_threads) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct Generator gen;
+    gen.mat = *mat;
+    gen.size = tb_table_size(mat);
+    gen.result = malloc(gen.size);
+    gen.moves_left = malloc(gen.size);
+    gen.conversion = malloc(gen.size);
+    gen.level = 0;
+    atomic_init(&gen.next_chunk, 0);
+    atomic_init(&gen.num_changed, 0);
+    atomic_init(&gen.max_conversion_dtm, 0);
+    atomic_init(&gen.missing_table, false);
+    if (gen.result == NULL || gen.moves_left == NULL || gen.conversion == NULL) {
+        fprintf(stderr, "%s: out of memory\n", mat->name);
+        free((void*) gen.result);
+        free((void*) gen.moves_left);
+        free(gen.conversion);
+        return false;
+    }
+
+    run_parallel(&gen, init_range, num_threads);
+    if (atomic_load(&gen.missing_table)) {
+        fprintf(stderr, "%s: tables reached by captures or promotions are missing from %s\n", mat->name, dir);
+        free((void*) gen.result);
+        free((void*) gen.moves_left);
+        free(gen.conversion);
+        return false;
+    }
+
+    //Stop after two levels without changes, once no capture or promotion can resolve anything anymore.
+    int idle_levels = 0;
+    for (gen.level = 1; gen.level <= TB_MAX_DTM; ++gen.level) {
+        atomic_store(&gen.num_changed, 0);
+        run_parallel(&gen, propagate_range, num_threads);
+        run_parallel(&gen, scan_range, num_threads);
+
+        idle_levels = atomic_load(&gen.num_changed) ? 0 : idle_levels + 1;
+        if (idle_levels >= 2 && gen.level > atomic_load(&gen.max_conversion_dtm))
+            break;
+    }
+    if (gen.level > TB_MAX_DTM)
+        fprintf(stderr, "%s: warning, mates longer than %d plies are stored as draws\n", mat->name, TB_MAX_DTM);
+
+    for (u64 idx = 0; idx < gen.size; ++idx) {
+        if (gen.result[idx] == UNKNOWN)
+            gen.result[idx] = TB_DRAW;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    print_summary(&gen, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    //The atomic bytes have the same representation as plain ones.
+    bool ok = tb_write(dir, mat, (const unsigned char*) gen.result);
+    if (!ok)
+        fprintf(stderr, "%s: failed to write the table to %s\n", mat->name, dir);
+
+    free((void*) gen.result);
+    free((void*) gen.moves_left);
+    free(gen.conversion);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    int num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    const char *dir = DEFAULT_OUTPUT_DIR;
+    int max_pieces = TB_MAX_PIECES;
+
+    cag_option_context ctx;
+    cag_option_prepare(&ctx, options, CAG_ARRAY_SIZE(options), argc, argv);
+    while (cag_option_fetch(&ctx)) {
+        switch (cag_option_get(&ctx)) {
+            case 't':
+                num_threads = atoi(cag_option_get_value(&ctx));
+                break;
+            case 'o':
+                dir = cag_option_get_value(&ctx);
+                break;
+            case 'n':
+                max_pieces = atoi(cag_option_get_value(&ctx));
+                break;
+            case 'h':
+                printf("Usage: tbgen [OPTION]... [TABLE]...\n"
+                       "Generates endgame tables, e.g. KQvKR. Without tables, generates all of them.\n");
+                cag_option_print(options, CAG_ARRAY_SIZE(options), stdout);
+                return EXIT_SUCCESS;
+        }
+    }
+
+    if (num_threads < 1)
+        num_threads = 1;
+    if (max_pieces < 3 || max_pieces > TB_MAX_PIECES) {
+        fprintf(stderr, "Tables with 3 to %d pieces are supported\n", TB_MAX_PIECES);
+        return EXIT_FAILURE;
+    }
+
+    init_LUTs();
+
+    struct Tb_material mats[64];
+    int num_mats = 0;
+    int first_table = cag_option_get_index(&ctx);
+    if (first_table < argc) {
+        //Explicitly named tables, the tables they depend on must already have been generated.
+        for (int i = first_table; i < argc && num_mats < 64; ++i) {
+            if (!tb_material_from_name(argv[i], &mats[num_mats++])) {
+                fprintf(stderr, "Invalid table name %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    } else {
+        num_mats = tb_all_materials(mats, 64, max_pieces);
+    }
+
+    for (int i = 0; i < num_mats; ++i) {
+        //Reload so that the tables generated so far can be probed for captures and promotions.
+        tb_init(dir);
+        if (!generate(&mats[i], dir, num_threads))
+            return EXIT_FAILURE;
+    }
+
+    tb_free();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,435 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cargs.h>
+
+#include "bitbase.h"
+#include "evaluation.h"
+#include "packed.h"
+#include "position.h"
+#include "search.h"
+#include "tables.h"
+
+/*
+    Texel tuning of the evaluation parameters.
+
+    Every position of a dataset written by datagen is first resolved with a quiescence search, and the
+    quiet position at the end of its principal variation is stored as the list of its evaluation terms.
+    The evaluation is linear in the parameters, so the evaluation of every position and the gradient of
+    the error are computed from those terms directly, without the engine.
+
+    The error is the mean squared difference between sigmoid(K * eval / 400) and the target, a mix of the
+    game result and the search score given by lambda. K is fitted to the initial parameters. The parameters
+    are optimized with Adam on the full gradient, which is computed by all threads on their own slices
+    of the dataset.
+*/
+
+#define DEFAULT_EPOCHS 500
+#define DEFAULT_RATE 1.0
+#define DEFAULT_LAMBDA 1.0
+#define PROGRESS_INTERVAL 25
+
+#define ADAM_BETA1 0.9
+#define ADAM_BETA2 0.999
+#define ADAM_EPSILON 1e-8
+
+static struct cag_option options[] = {
+    {
+     .identifier = 'i',
+     .access_letters = "i",
+     .access_name = "input",
+     .value_name = "FILE",
+     .description = "Dataset of packed positions written by datagen"
+    },
+    {
+     .identifier = 'o',
+     .access_letters = "o",
+     .access_name = "output",
+     .value_name = "FILE",
+     .description = "File the tuned parameters are written to as C source (default: stdout)"
+    },
+    {
+     .identifier = 't',
+     .access_letters = "t",
+     .access_name = "threads",
+     .value_name = "THREADS",
+     .description = "Number of threads (default: number of cores)"
+    },
+    {
+     .identifier = 'e',
+     .access_letters = "e",
+     .access_name = "epochs",
+     .value_name = "EPOCHS",
+     .description = "Number of optimization steps (default 500)"
+    },
+    {
+     .identifier = 'r',
+     .access_letters = "r",
+     .access_name = "rate",
+     .value_name = "RATE",
+     .description = "Learning rate in centipawns (default 1.0)"
+    },
+    {
+     .identifier = 'l',
+     .access_letters = "l",
+     .access_name = "lambda",
+     .value_name = "LAMBDA",
+     .description = "Weight of the game result in the target, the rest is the search score (default 1.0)"
+    },
+    {
+     .identifier = 'k',
+     .access_letters = "k",
+     .access_name = "scale",
+     .value_name = "K",
+     .description = "Sigmoid scale, fitted to the data if not given"
+    },
+    {
+     .identifier = 'h',
+     .access_letters = "h",
+     .access_name = "help",
+     .value_name = NULL,
+     .description = "Show this help"
+    }
+};
+
+struct Tune_entry {
+    u64 first_term;
+    int num_terms;
+    float result; //From the point of view of white: 0, 0.5 or 1
+    float score;  //Search score from the point of view of white
+};
+
+//The positions of one thread.
+struct Tune_slice {
+    struct Tune_entry *entries;
+    size_t num_entries;
+    u64 num_corrupt;
+    struct Eval_term *terms;
+    u64 num_terms;
+    double error;
+    double gradient[NUM_EVAL_PARAMS];
+};
+
+struct Tuner {
+    struct Packed_file dataset;
+    int num_threads;
+    struct Tune_slice *slices;
+    double params[NUM_EVAL_PARAMS];
+    double K;
+    double lambda;
+};
+
+typedef void (*Slice_fn)(struct Tuner *tuner, int id);
+
+struct Worker_args {
+    struct Tuner *tuner;
+    int id;
+    Slice_fn fn;
+};
+
+static void *worker(void *arg) {
+    struct Worker_args *args = arg;
+    args->fn(args->tuner, args->id);
+    return NULL;
+}
+
+static void run_parallel(struct Tuner *tuner, Slice_fn fn) {
+    pthread_t threads[tuner->num_threads];
+    struct Worker_args args[tuner->num_threads];
+    for (int i = 0; i < tuner->num_threads; ++i) {
+        args[i] = (struct Worker_args) { tuner, i, fn };
+        int rc = pthread_create(&threads[i], NULL, worker, &args[i]);
+        if (rc) {
+            fprintf(stderr, "Non-zero return address when spawning thread: rc %d\n", rc);
+            exit(-1);
+        }
+    }
+    for (int i = 0; i < tuner->num_threads; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+static double sigmoid(double K, double eval) {
+    return 1.0 / (1.0 + exp(-K * eval / 400.0));
+}
+
+static double entry_eval(const struct Tuner *tuner, const struct Tune_slice *slice, const struct Tune_entry *entry) {
+    double eval = 0.0;
+    const struct Eval_term *terms = &slice->terms[entry->first_term];
+    for (int i = 0; i < entry->num_terms; ++i)
+        eval += terms[i].coeff * tuner->params[terms[i].param];
+    return eval;
+}
+
+static double entry_target(const struct Tuner *tuner, const struct Tune_entry *entry) {
+    return tuner->lambda * entry->result + (1.0 - tuner->lambda) * sigmoid(tuner->K, entry->score);
+}
+
+//Resolves the positions of the slice with a quiescence search and stores the terms of the quiet positions.
+static void load_slice(struct Tuner *tuner, int id) {
+    struct Tune_slice *slice = &tuner->slices[id];
+    u64 count = tuner->dataset.count;
+    u64 begin = count * id / tuner->num_threads;
+    u64 end = count * (id + 1) / tuner->num_threads;
+
+    slice->entries = malloc((end - begin + 1) * sizeof(struct Tune_entry));
+    slice->terms = malloc((end - begin + 1) * MAX_EVAL_TERMS * sizeof(struct Eval_term));
+    slice->num_entries = 0;
+    slice->num_corrupt = 0;
+    slice->num_terms = 0;
+
+    struct Search_info *si = malloc(sizeof(struct Search_info));
+    struct Search_limits limits = { 0 };
+    for (u64 idx = begin; idx < end; ++idx) {
+        const struct Packed_position *packed = &tuner->dataset.records[idx];
+        struct Position pos;
+        if (!unpack_position(packed, &pos)) {
+            ++slice->num_corrupt;
+            continue;
+        }
+
+        search_info_init(si, limits);
+        si->silent = true;
+        quiescence(si, &pos, 0, -1000000, 1000000);
+        for (int ply = 0; ply < si->pv_length[0]; ++ply)
+            make_move(si->pv_table[0][ply], &pos, si->move_stack);
+        search_info_destroy(si);
+
+        //KPK endgames are scored by the bitbase, not by the parameters.
+        if (kpk_probe_position(&pos) != KPK_NONE)
+            continue;
+
+        struct Tune_entry *entry = &slice->entries[slice->num_entries++];
+        entry->first_term = slice->num_terms;
+        entry->num_terms = eval_terms(&pos, &slice->terms[slice->num_terms]);
+        entry->result = packed->result / 2.0f;
+        entry->score = packed->score;
+        slice->num_terms += entry->num_terms;
+    }
+    free(si);
+
+    //Most positions have fewer pieces than the maximum.
+    if (slice->num_terms > 0)
+        slice->terms = realloc(slice->terms, slice->num_terms * sizeof(struct Eval_term));
+}
+
+static void error_slice(struct Tuner *tuner, int id) {
+    struct Tune_slice *slice = &tuner->slices[id];
+    double error = 0.0;
+    for (size_t i = 0; i < slice->num_entries; ++i) {
+        const struct Tune_entry *entry = &slice->entries[i];
+        double diff = entry_target(tuner, entry) - sigmoid(tuner->K, entry_eval(tuner, slice, entry));
+        error += diff * diff;
+    }
+    slice->error = error;
+}
+
+//Gradient of the error, up to a constant factor that the optimizer doesn't depend on.
+static void gradient_slice(struct Tuner *tuner, int id) {
+    struct Tune_slice *slice = &tuner->slices[id];
+    double error = 0.0;
+    memset(slice->gradient, 0, sizeof(slice->gradient));
+    for (size_t i = 0; i < slice->num_entries; ++i) {
+        const struct Tune_entry *entry = &slice->entries[i];
+        double s = sigmoid(tuner->K, entry_eval(tuner, slice, entry));
+        double diff = s - entry_target(tuner, entry);
+        error += diff * diff;
+
+        double factor = diff * s * (1.0 - s);
+        const struct Eval_term *terms = &slice->terms[entry->first_term];
+        for (int j = 0; j < entry->num_terms; ++j)
+            slice->gradient[terms[j].param] += factor * terms[j].coeff;
+    }
+    slice->error = error;
+}
+
+static size_t num_entries(const struct Tuner *tuner) {
+    size_t n = 0;
+    for (int i = 0; i < tuner->num_threads; ++i)
+        n += tuner->slices[i].num_entries;
+    return n;
+}
+
+static double total_error(struct Tuner *tuner) {
+    run_parallel(tuner, error_slice);
+    double error = 0.0;
+    for (int i = 0; i < tuner->num_threads; ++i)
+        error += tuner->slices[i].error;
+    return error / num_entries(tuner);
+}
+
+//Golden section search for the K with the lowest error.
+static double fit_K(struct Tuner *tuner) {
+    const double ratio = (sqrt(5.0) - 1.0) / 2.0;
+    double low = 0.01, high = 10.0;
+    while (high - low > 1e-3) {
+        double k1 = high - ratio * (high - low);
+        double k2 = low + ratio * (high - low);
+        tuner->K = k1;
+        double e1 = total_error(tuner);
+        tuner->K = k2;
+        double e2 = total_error(tuner);
+        if (e1 < e2)
+            high = k2;
+        else
+            low = k1;
+    }
+    return (low + high) / 2.0;
+}
+
+static void optimize(struct Tuner *tuner, int epochs, double rate) {
+    double *m = calloc(NUM_EVAL_PARAMS, sizeof(double));
+    double *v = calloc(NUM_EVAL_PARAMS, sizeof(double));
+    double gradient[NUM_EVAL_PARAMS];
+    size_t n = num_entries(tuner);
+
+    for (int epoch = 1; epoch <= epochs; ++epoch) {
+        run_parallel(tuner, gradient_slice);
+        double error = 0.0;
+        memset(gradient, 0, sizeof(gradient));
+        for (int i = 0; i < tuner->num_threads; ++i) {
+            error += tuner->slices[i].error;
+            for (int p = 0; p < NUM_EVAL_PARAMS; ++p)
+                gradient[p] += tuner->slices[i].gradient[p];
+        }
+
+        double correction1 = 1.0 - pow(ADAM_BETA1, epoch);
+        double correction2 = 1.0 - pow(ADAM_BETA2, epoch);
+        for (int p = 0; p < NUM_EVAL_PARAMS; ++p) {
+            double g = gradient[p] / n;
+            m[p] = ADAM_BETA1 * m[p] + (1.0 - ADAM_BETA1) * g;
+            v[p] = ADAM_BETA2 * v[p] + (1.0 - ADAM_BETA2) * g * g;
+            tuner->params[p] -= rate * (m[p] / correction1) / (sqrt(v[p] / correction2) + ADAM_EPSILON);
+        }
+
+        if (epoch % PROGRESS_INTERVAL == 0 || epoch == epochs)
+            fprintf(stderr, "Epoch %d, error %.6f\n", epoch, error / n);
+    }
+
+    free(v);
+    free(m);
+}
+
+static void write_params(FILE *f, const struct Tuner *tuner, double error) {
+    static const char *piece_names[] = { "Pawn", "Knight", "Bishop", "Rook", "Queen", "King" };
+    int values[NUM_EVAL_PARAMS];
+    for (int p = 0; p < NUM_EVAL_PARAMS; ++p)
+        values[p] = (int) lround(tuner->params[p]);
+
+    fprintf(f, "//Tuned on %zu positions, K = %.3f, error = %.6f\n", num_entries(tuner), tuner->K, error);
+    fprintf(f, "int eval_params[NUM_EVAL_PARAMS] = {\n");
+    fprintf(f, "    //Piece values: pawn, knight, bishop, rook, queen\n   ");
+    for (int pt = PAWN; pt <= QUEEN; ++pt)
+        fprintf(f, " %d,", values[PARAM_PIECE_VALUE(pt)]);
+    fprintf(f, "\n    //Piece-square tables from the point of view of white, a1 first\n");
+    for (int pt = PAWN; pt <= KING; ++pt) {
+        fprintf(f, "    //%s\n", piece_names[pt]);
+        for (int rank = 0; rank < 8; ++rank) {
+            fprintf(f, "   ");
+            for (int file = 0; file < 8; ++file)
+                fprintf(f, " %d%s", values[PARAM_PSQT(pt, 8 * rank + file)], file < 7 ? "," : ",\n");
+        }
+    }
+    fprintf(f, "};\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct Tuner tuner = {0};
+    const char *input = NULL;
+    const char *output = NULL;
+    int epochs = DEFAULT_EPOCHS;
+    double rate = DEFAULT_RATE;
+    double K = 0.0;
+    tuner.num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    tuner.lambda = DEFAULT_LAMBDA;
+
+    cag_option_context ctx;
+    cag_option_prepare(&ctx, options, CAG_ARRAY_SIZE(options), argc, argv);
+    while (cag_option_fetch(&ctx)) {
+        const char *value = cag_option_get_value(&ctx);
+        switch (cag_option_get(&ctx)) {
+            case 'i':
+                input = value;
+                break;
+            case 'o':
+                output = value;
+                break;
+            case 't':
+                tuner.num_threads = atoi(value);
+                break;
+            case 'e':
+                epochs = atoi(value);
+                break;
+            case 'r':
+                rate = atof(value);
+                break;
+            case 'l':
+                tuner.lambda = atof(value);
+                break;
+            case 'k':
+                K = atof(value);
+                break;
+            case 'h':
+                printf("Usage: tune -i FILE [OPTION]...\nTunes the evaluation parameters on a dataset.\n");
+                cag_option_print(options, CAG_ARRAY_SIZE(options), stdout);
+                return EXIT_SUCCESS;
+        }
+    }
+
+    if (input == NULL) {
+        fprintf(stderr, "No dataset given, see tune -h\n");
+        return EXIT_FAILURE;
+    }
+    if (tuner.num_threads <= 0)
+        tuner.num_threads = 1;
+
+    init_LUTs();
+    if (!packed_file_open(&tuner.dataset, input)) {
+        fprintf(stderr, "Could not open %s\n", input);
+        return EXIT_FAILURE;
+    }
+
+    for (int p = 0; p < NUM_EVAL_PARAMS; ++p)
+        tuner.params[p] = eval_params[p];
+    tuner.slices = calloc(tuner.num_threads, sizeof(struct Tune_slice));
+    run_parallel(&tuner, load_slice);
+    u64 num_corrupt = 0;
+    for (int i = 0; i < tuner.num_threads; ++i)
+        num_corrupt += tuner.slices[i].num_corrupt;
+    if (num_corrupt > 0)
+        fprintf(stderr, "Skipped %llu corrupt records in %s\n", (unsigned long long) num_corrupt, input);
+    if (num_entries(&tuner) == 0) {
+        fprintf(stderr, "No positions to tune on in %s\n", input);
+        return EXIT_FAILURE;
+    }
+
+    tuner.K = K > 0.0 ? K : fit_K(&tuner);
+    double initial_error = total_error(&tuner);
+    fprintf(stderr, "Positions: %zu, K: %.3f, initial error: %.6f\n", num_entries(&tuner), tuner.K, initial_error);
+
+    optimize(&tuner, epochs, rate);
+    double error = total_error(&tuner);
+    fprintf(stderr, "Final error: %.6f\n", error);
+
+    FILE *f = output ? fopen(output, "w") : stdout;
+    if (f == NULL) {
+        fprintf(stderr, "Could not open %s\n", output);
+        return EXIT_FAILURE;
+    }
+    write_params(f, &tuner, error);
+    if (f != stdout)
+        fclose(f);
+
+    for (int i = 0; i < tuner.num_threads; ++i) {
+        free(tuner.slices[i].entries);
+        free(tuner.slices[i].terms);
+    }
+    free(tuner.slices);
+    packed_file_close(&tuner.dataset);
+    return EXIT_SUCCESS;
+}